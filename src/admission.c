@@ -0,0 +1,147 @@
+/**
+ * @file admission.c
+ * Admission control (shedding of load when the event loop falls behind)
+ *
+ * Connections are shed right after the accept when there are too many of them or when the queueing delay
+ * is too long. Events handled in one iteration of the event loop wait for the previous ones, so the length
+ * of the iteration is the queueing delay of the events coming meanwhile. Requests for CPU load (expensive ones,
+ * they hold the connection until the sample is taken) have their own limit.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "admission.h"
+
+/**
+ * Weight of the new delay in the smoothed queueing delay (1/N)
+ */
+#define DELAY_SMOOTHING 8
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in microseconds
+ */
+uint64_t admission_time_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+/**
+ * Inits the admission control
+ *
+ * @param admission Admission control to init
+ * @param max_connections Maximum number of open connections (0 => no limit)
+ * @param max_waiting Maximum number of connections waiting for CPU load (0 => no limit)
+ * @param max_delay Maximum smoothed queueing delay in milliseconds (0 => delay isn't measured)
+ */
+void admission_init(struct admission *admission, unsigned max_connections, unsigned max_waiting, unsigned max_delay) {
+    memset(admission, 0, sizeof(*admission));
+    admission->max_connections = max_connections;
+    admission->max_waiting = max_waiting;
+    admission->max_delay = (uint64_t) max_delay * 1000;
+
+    // The response doesn't depend on the request, so it is prepared just once
+    admission->response_length = (size_t) snprintf(admission->response, sizeof(admission->response),
+                                                   "HTTP/1.1 503 Service Unavailable\r\n"
+                                                   "Connection: close\r\n"
+                                                   "Server: hinfosvc/1.0\r\n"
+                                                   "Retry-After: 1\r\n"
+                                                   "Content-Length: 0\r\n"
+                                                   "\r\n");
+}
+
+/**
+ * Marks the start of the iteration of the event loop (its events are handled from now), the smoothed queueing
+ * delay decays by the time the event loop has waited idle for the events
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_iteration_start(struct admission *admission) {
+    uint64_t idle;
+
+    if (admission->max_delay == 0) {
+        return;
+    }
+
+    admission->iteration_start = admission_time_us();
+
+    // Nothing has been queued while the event loop waited, so one long iteration followed by a pause
+    // doesn't shed connections coming to the idle event loop
+    if (admission->iteration_end > 0) {
+        idle = admission->iteration_start - admission->iteration_end;
+        admission->delay = idle < admission->delay ? admission->delay - idle : 0;
+    }
+}
+
+/**
+ * Marks the end of the iteration of the event loop and updates the smoothed queueing delay
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_iteration_end(struct admission *admission) {
+    uint64_t length;
+
+    if (admission->max_delay == 0) {
+        return;
+    }
+
+    // Short (idle) iterations decrease the delay, so shedding stops when the event loop catches up
+    admission->iteration_end = admission_time_us();
+    length = admission->iteration_end - admission->iteration_start;
+    admission->delay = (admission->delay * (DELAY_SMOOTHING - 1) + length) / DELAY_SMOOTHING;
+}
+
+/**
+ * Admits a new connection
+ *
+ * @param admission Admission control of the event loop
+ * @return Is the connection admitted? (not admitted connection must be shed)
+ */
+bool admission_enter(struct admission *admission) {
+    if ((admission->max_connections > 0 && admission->connections >= admission->max_connections)
+        || (admission->max_delay > 0 && admission->delay > admission->max_delay)) {
+        return false;
+    }
+
+    admission->connections++;
+    return true;
+}
+
+/**
+ * Releases the place of the closed admitted connection
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_leave(struct admission *admission) {
+    admission->connections--;
+}
+
+/**
+ * Admits the connection to wait for CPU load
+ *
+ * @param admission Admission control of the event loop
+ * @return Is the waiting admitted? (not admitted request must be shed)
+ */
+bool admission_park(struct admission *admission) {
+    if (admission->max_waiting > 0 && admission->waiting >= admission->max_waiting) {
+        return false;
+    }
+
+    admission->waiting++;
+    return true;
+}
+
+/**
+ * Releases the place of the connection that doesn't wait for CPU load anymore
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_unpark(struct admission *admission) {
+    admission->waiting--;
+}
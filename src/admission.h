@@ -0,0 +1,99 @@
+#ifndef HINFOSVC_ADMISSION_H
+#define HINFOSVC_ADMISSION_H
+/**
+ * @file admission.h
+ * Header of admission control (shedding of load when the event loop falls behind)
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Maximum length of the precomputed 503 response
+ */
+#define ADMISSION_RESPONSE_LEN 160
+
+/**
+ * Admission control of one event loop (it isn't thread safe, each event loop must have its own one)
+ */
+struct admission {
+    // Maximum number of open connections (0 => no limit)
+    unsigned max_connections;
+    // Maximum number of connections waiting for CPU load, parked requests and streams (0 => no limit)
+    unsigned max_waiting;
+    // Maximum smoothed queueing delay (in microseconds, 0 => delay isn't measured)
+    uint64_t max_delay;
+    // Number of open connections
+    unsigned connections;
+    // Number of connections waiting for CPU load
+    unsigned waiting;
+    // Start of the current iteration of the event loop (monotonic time in microseconds)
+    uint64_t iteration_start;
+    // End of the previous iteration of the event loop (monotonic time in microseconds, 0 => no iteration yet)
+    uint64_t iteration_end;
+    // Smoothed queueing delay (in microseconds)
+    uint64_t delay;
+    // Precomputed response for shed requests
+    char response[ADMISSION_RESPONSE_LEN + 1];
+    // Length of the precomputed response
+    size_t response_length;
+};
+
+/**
+ * Inits the admission control
+ *
+ * @param admission Admission control to init
+ * @param max_connections Maximum number of open connections (0 => no limit)
+ * @param max_waiting Maximum number of connections waiting for CPU load (0 => no limit)
+ * @param max_delay Maximum smoothed queueing delay in milliseconds (0 => delay isn't measured)
+ */
+void admission_init(struct admission *admission, unsigned max_connections, unsigned max_waiting, unsigned max_delay);
+
+/**
+ * Marks the start of the iteration of the event loop (its events are handled from now), the smoothed queueing
+ * delay decays by the time the event loop has waited idle for the events
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_iteration_start(struct admission *admission);
+
+/**
+ * Marks the end of the iteration of the event loop and updates the smoothed queueing delay
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_iteration_end(struct admission *admission);
+
+/**
+ * Admits a new connection
+ *
+ * @param admission Admission control of the event loop
+ * @return Is the connection admitted? (not admitted connection must be shed)
+ */
+bool admission_enter(struct admission *admission);
+
+/**
+ * Releases the place of the closed admitted connection
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_leave(struct admission *admission);
+
+/**
+ * Admits the connection to wait for CPU load
+ *
+ * @param admission Admission control of the event loop
+ * @return Is the waiting admitted? (not admitted request must be shed)
+ */
+bool admission_park(struct admission *admission);
+
+/**
+ * Releases the place of the connection that doesn't wait for CPU load anymore
+ *
+ * @param admission Admission control of the event loop
+ */
+void admission_unpark(struct admission *admission);
+
+#endif //HINFOSVC_ADMISSION_H
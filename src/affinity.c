@@ -0,0 +1,220 @@
+/**
+ * @file affinity.c
+ * CPU and NUMA placement of threads
+ *
+ * CPUs of NUMA nodes are read from sysfs and the memory policy is set by the raw system call,
+ * so no libnuma is needed.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#define _GNU_SOURCE // cpu_set_t, pthread_attr_setaffinity_np()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "affinity.h"
+
+/**
+ * Maximum length of the list of CPUs of a NUMA node (in kernel format, e.g. "0-15,32-47")
+ */
+#define CPU_LIST_LEN 1024
+
+/**
+ * Parses the number of CPU or of NUMA node
+ *
+ * @param str Number as a string
+ * @param number Pointer to the place where to save the number
+ * @param end Pointer to the place where to save the pointer to the first character after the number
+ * @return 0 => success, 1 => error (no number or too big number)
+ */
+int parse_cpu_number(const char *str, unsigned long *number, const char **end) {
+    char *number_end;
+
+    if (*str < '0' || *str > '9') {
+        return 1;
+    }
+
+    *number = strtoul(str, &number_end, 10);
+    *end = number_end;
+
+    return *number >= CPU_SETSIZE;
+}
+
+/**
+ * Adds CPUs of the list to the set
+ *
+ * @param list List of CPUs in kernel format ("0-3,8,10-11"), it ends by a null byte or a new line
+ * @param cpus Set to add CPUs to
+ * @return 0 => success, 1 => error (invalid list)
+ */
+int add_cpu_list(const char *list, cpu_set_t *cpus) {
+    unsigned long first, last;
+
+    while (*list != '\0' && *list != '\n') {
+        if (parse_cpu_number(list, &first, &list) != 0) {
+            return 1;
+        }
+        last = first;
+        if (*list == '-' && parse_cpu_number(list + 1, &last, &list) != 0) {
+            return 1;
+        }
+        if (first > last || (*list != ',' && *list != '\0' && *list != '\n')) {
+            return 1;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*list == ',') {
+            list++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Loads CPUs of the NUMA node
+ *
+ * @param node Number of the NUMA node
+ * @param cpus Set to add CPUs to
+ * @return 0 => success, 1 => error (unknown node)
+ */
+int load_node_cpus(unsigned long node, cpu_set_t *cpus) {
+    char path[64];
+    char list[CPU_LIST_LEN + 1];
+    FILE *file;
+    int result;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%lu/cpulist", node);
+    if ((file = fopen(path, "r")) == NULL) {
+        return 1;
+    }
+
+    result = fgets(list, sizeof(list), file) == NULL || add_cpu_list(list, cpus) != 0;
+    fclose(file);
+
+    // Node without CPUs (memory only node) can't run threads
+    return result != 0 || CPU_COUNT(cpus) == 0;
+}
+
+/**
+ * Parses the placement: CPU, CPU-CPU (range of CPUs) or nodeN (all CPUs of the NUMA node)
+ *
+ * @param spec Specification of the placement
+ * @param affinity Pointer to the place where to save the placement
+ * @param end Pointer to the place where to save the pointer to the first character after the specification
+ * @return 0 => success, 1 => error (invalid specification or unknown NUMA node)
+ */
+int affinity_parse(const char *spec, struct cpu_affinity *affinity, const char **end) {
+    unsigned long first, last;
+
+    CPU_ZERO(&affinity->cpus);
+    affinity->node = -1;
+
+    if (strncmp(spec, "node", 4) == 0) {
+        if (parse_cpu_number(&spec[4], &first, end) != 0) {
+            fprintf(stderr, "Invalid NUMA node: %s\n", spec);
+            return 1;
+        }
+        if (load_node_cpus(first, &affinity->cpus) != 0) {
+            fprintf(stderr, "Cannot load CPUs of NUMA node %lu\n", first);
+            return 1;
+        }
+
+        affinity->node = (int) first;
+        return 0;
+    }
+
+    if (parse_cpu_number(spec, &first, end) != 0) {
+        fprintf(stderr, "Invalid CPU: %s\n", spec);
+        return 1;
+    }
+    last = first;
+    if (**end == '-' && (parse_cpu_number(*end + 1, &last, end) != 0 || first > last)) {
+        fprintf(stderr, "Invalid range of CPUs: %s\n", spec);
+        return 1;
+    }
+
+    for (unsigned long cpu = first; cpu <= last; cpu++) {
+        CPU_SET(cpu, &affinity->cpus);
+    }
+
+    return 0;
+}
+
+/**
+ * Computes the placement on CPUs not used by other threads (from CPUs the process may run on)
+ *
+ * @param used Placements of other threads
+ * @param count Number of the placements
+ * @param spare Pointer to the place where to save the placement
+ * @return 0 => success, 1 => error (no CPU is left)
+ */
+int affinity_spare(const struct cpu_affinity *used, unsigned count, struct cpu_affinity *spare) {
+    spare->node = -1;
+
+    if (sched_getaffinity(0, sizeof(spare->cpus), &spare->cpus) == -1) {
+        fprintf(stderr, "Cannot load CPUs of the process\n");
+        return 1;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &used[i].cpus)) {
+                CPU_CLR(cpu, &spare->cpus);
+            }
+        }
+    }
+
+    if (CPU_COUNT(&spare->cpus) == 0) {
+        fprintf(stderr, "No CPU is left for the sampler (all of them are used by workers)\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Sets CPUs of the thread that will be created with the attributes
+ *
+ * @param attr Attributes of the thread
+ * @param affinity Placement of the thread (NULL => the thread isn't pinned)
+ * @return 0 => success, 1 => error
+ */
+int affinity_set_attr(pthread_attr_t *attr, const struct cpu_affinity *affinity) {
+    if (affinity == NULL) {
+        return 0;
+    }
+
+    // The thread is pinned from its start, so it never runs (and allocates memory) on other CPUs
+    if (pthread_attr_setaffinity_np(attr, sizeof(affinity->cpus), &affinity->cpus) != 0) {
+        fprintf(stderr, "Cannot set CPUs of thread\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Makes memory allocated by the calling thread come from its NUMA node
+ *
+ * Failure isn't fatal (the default policy allocates from the node of the CPU anyway), so just a warning is printed.
+ *
+ * @param affinity Placement of the thread (NULL => the thread isn't pinned)
+ */
+void affinity_bind_memory(const struct cpu_affinity *affinity) {
+    unsigned long node_mask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = {0};
+
+    // Threads pinned to CPUs get memory of the node of the CPU by the default (first touch) policy
+    if (affinity == NULL || affinity->node < 0) {
+        return;
+    }
+
+    node_mask[affinity->node / (8 * sizeof(unsigned long))] |= 1UL << (affinity->node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask, CPU_SETSIZE + 1) == -1) {
+        fprintf(stderr, "Cannot prefer memory of NUMA node %d (default policy is used)\n", affinity->node);
+    }
+}
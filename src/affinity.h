@@ -0,0 +1,62 @@
+#ifndef HINFOSVC_AFFINITY_H
+#define HINFOSVC_AFFINITY_H
+/**
+ * @file affinity.h
+ * Header of CPU and NUMA placement of threads
+ *
+ * cpu_set_t is a GNU extension, so _GNU_SOURCE must be defined before the first include of the module.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <sched.h>
+#include <pthread.h>
+
+/**
+ * Placement of a thread
+ */
+struct cpu_affinity {
+    // CPUs the thread may run on
+    cpu_set_t cpus;
+    // NUMA node memory of the thread is allocated from (-1 => default policy, the node of the CPU)
+    int node;
+};
+
+/**
+ * Parses the placement: CPU, CPU-CPU (range of CPUs) or nodeN (all CPUs of the NUMA node)
+ *
+ * @param spec Specification of the placement
+ * @param affinity Pointer to the place where to save the placement
+ * @param end Pointer to the place where to save the pointer to the first character after the specification
+ * @return 0 => success, 1 => error (invalid specification or unknown NUMA node)
+ */
+int affinity_parse(const char *spec, struct cpu_affinity *affinity, const char **end);
+
+/**
+ * Computes the placement on CPUs not used by other threads (from CPUs the process may run on)
+ *
+ * @param used Placements of other threads
+ * @param count Number of the placements
+ * @param spare Pointer to the place where to save the placement
+ * @return 0 => success, 1 => error (no CPU is left)
+ */
+int affinity_spare(const struct cpu_affinity *used, unsigned count, struct cpu_affinity *spare);
+
+/**
+ * Sets CPUs of the thread that will be created with the attributes
+ *
+ * @param attr Attributes of the thread
+ * @param affinity Placement of the thread (NULL => the thread isn't pinned)
+ * @return 0 => success, 1 => error
+ */
+int affinity_set_attr(pthread_attr_t *attr, const struct cpu_affinity *affinity);
+
+/**
+ * Makes memory allocated by the calling thread come from its NUMA node
+ *
+ * Failure isn't fatal (the default policy allocates from the node of the CPU anyway), so just a warning is printed.
+ *
+ * @param affinity Placement of the thread (NULL => the thread isn't pinned)
+ */
+void affinity_bind_memory(const struct cpu_affinity *affinity);
+
+#endif //HINFOSVC_AFFINITY_H
@@ -0,0 +1,196 @@
+/**
+ * @file aggregation.c
+ * Aggregation kernels for CPU load history
+ *
+ * Kernels work over contiguous arrays of values. AVX2 kernels process 8 values per instruction,
+ * they are compiled for AVX2 separately (the rest of the program doesn't need it) and they are used
+ * only if the CPU supports it.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include "aggregation.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Computes minimum, maximum and sum of the values (portable implementation)
+ *
+ * @param values Array of values
+ * @param count Number of values (at least 1)
+ * @param summary Pointer to the place where to save the summary
+ */
+void summarize_scalar(const int32_t *values, size_t count, struct load_summary *summary) {
+    int32_t min = values[0];
+    int32_t max = values[0];
+    int64_t sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+        sum += values[i];
+    }
+
+    *summary = (struct load_summary) {min, max, sum, count};
+}
+
+/**
+ * Counts values lower than or equal to the threshold (portable implementation)
+ *
+ * @param values Array of values
+ * @param count Number of values
+ * @param threshold The highest counted value
+ * @return Number of values not greater than the threshold
+ */
+size_t count_at_most_scalar(const int32_t *values, size_t count, int32_t threshold) {
+    size_t result = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        result += values[i] <= threshold;
+    }
+
+    return result;
+}
+
+/**
+ * Portable implementation of aggregation kernels
+ */
+const struct aggregation_kernels scalar_kernels = {"scalar", summarize_scalar, count_at_most_scalar};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * Computes minimum, maximum and sum of the values (AVX2 implementation)
+ *
+ * @param values Array of values
+ * @param count Number of values (at least 1)
+ * @param summary Pointer to the place where to save the summary
+ */
+__attribute__((target("avx2")))
+void summarize_avx2(const int32_t *values, size_t count, struct load_summary *summary) {
+    __m256i min = _mm256_set1_epi32(values[0]);
+    __m256i max = min;
+    // Sums are 64-bit (4 lanes per half of the vector), so they can't overflow
+    __m256i sum = _mm256_setzero_si256();
+    __m256i chunk;
+    int32_t lanes[8];
+    int64_t sums[4];
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        chunk = _mm256_loadu_si256((const __m256i *) &values[i]);
+        min = _mm256_min_epi32(min, chunk);
+        max = _mm256_max_epi32(max, chunk);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(chunk)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(chunk, 1)));
+    }
+
+    // Lanes are reduced, the tail is added one by one
+    *summary = (struct load_summary) {values[0], values[0], 0, count};
+    _mm256_storeu_si256((__m256i *) lanes, min);
+    for (int lane = 0; lane < 8; lane++) {
+        summary->min = lanes[lane] < summary->min ? lanes[lane] : summary->min;
+    }
+    _mm256_storeu_si256((__m256i *) lanes, max);
+    for (int lane = 0; lane < 8; lane++) {
+        summary->max = lanes[lane] > summary->max ? lanes[lane] : summary->max;
+    }
+    _mm256_storeu_si256((__m256i *) sums, sum);
+    for (int lane = 0; lane < 4; lane++) {
+        summary->sum += sums[lane];
+    }
+    for (; i < count; i++) {
+        summary->min = values[i] < summary->min ? values[i] : summary->min;
+        summary->max = values[i] > summary->max ? values[i] : summary->max;
+        summary->sum += values[i];
+    }
+}
+
+/**
+ * Counts values lower than or equal to the threshold (AVX2 implementation)
+ *
+ * @param values Array of values
+ * @param count Number of values
+ * @param threshold The highest counted value
+ * @return Number of values not greater than the threshold
+ */
+__attribute__((target("avx2")))
+size_t count_at_most_avx2(const int32_t *values, size_t count, int32_t threshold) {
+    __m256i limit = _mm256_set1_epi32(threshold);
+    // Comparison gives -1 for greater values, so subtracting it counts them (per lane)
+    __m256i greater = _mm256_setzero_si256();
+    int32_t lanes[8];
+    size_t result = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        greater = _mm256_sub_epi32(greater,
+                                   _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) &values[i]), limit));
+    }
+
+    _mm256_storeu_si256((__m256i *) lanes, greater);
+    for (int lane = 0; lane < 8; lane++) {
+        result += (uint32_t) lanes[lane];
+    }
+
+    return i - result + count_at_most_scalar(&values[i], count - i, threshold);
+}
+
+/**
+ * AVX2 implementation of aggregation kernels (it must be used only if the CPU supports AVX2)
+ */
+const struct aggregation_kernels avx2_kernels = {"avx2", summarize_avx2, count_at_most_avx2};
+
+#endif
+
+/**
+ * Returns the fastest implementation of aggregation kernels supported by the CPU
+ *
+ * @return Aggregation kernels
+ */
+const struct aggregation_kernels *aggregation_kernels(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+#endif
+
+    return &scalar_kernels;
+}
+
+/**
+ * Finds the percentile of the values (nearest rank method)
+ *
+ * The values aren't sorted, the value is found by binary search over the range of values
+ * with vectorised counting of values not greater than the middle.
+ *
+ * @param kernels Aggregation kernels to use
+ * @param values Array of values
+ * @param summary Summary of the values (from kernels->summarize())
+ * @param percentile Wanted percentile (0-100)
+ * @return The smallest value not lower than the percentile of the values
+ * @pre summary->count > 0
+ */
+int32_t aggregation_percentile(const struct aggregation_kernels *kernels, const int32_t *values,
+                               const struct load_summary *summary, unsigned percentile) {
+    // Rank of the wanted value (1 => the smallest value)
+    size_t rank = (summary->count * percentile + 99) / 100;
+    int64_t low = summary->min;
+    int64_t high = summary->max;
+    int64_t middle;
+
+    rank = rank > 0 ? rank : 1;
+
+    // The smallest value having at least rank values lower or equal
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (kernels->count_at_most(values, summary->count, (int32_t) middle) >= rank) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return (int32_t) low;
+}
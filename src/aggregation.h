@@ -0,0 +1,73 @@
+#ifndef HINFOSVC_AGGREGATION_H
+#define HINFOSVC_AGGREGATION_H
+/**
+ * @file aggregation.h
+ * Header of aggregation kernels for CPU load history
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Summary of the array of values
+ */
+struct load_summary {
+    // Minimum value
+    int32_t min;
+    // Maximum value
+    int32_t max;
+    // Sum of all values
+    int64_t sum;
+    // Number of values
+    size_t count;
+};
+
+/**
+ * Implementation of aggregation kernels (for one instruction set)
+ */
+struct aggregation_kernels {
+    // Name of the implementation
+    const char *name;
+    // Computes minimum, maximum and sum of the values (count > 0)
+    void (*summarize)(const int32_t *values, size_t count, struct load_summary *summary);
+    // Counts values lower than or equal to the threshold
+    size_t (*count_at_most)(const int32_t *values, size_t count, int32_t threshold);
+};
+
+/**
+ * Portable implementation of aggregation kernels
+ */
+extern const struct aggregation_kernels scalar_kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * AVX2 implementation of aggregation kernels (it must be used only if the CPU supports AVX2)
+ */
+extern const struct aggregation_kernels avx2_kernels;
+#endif
+
+/**
+ * Returns the fastest implementation of aggregation kernels supported by the CPU
+ *
+ * @return Aggregation kernels
+ */
+const struct aggregation_kernels *aggregation_kernels(void);
+
+/**
+ * Finds the percentile of the values (nearest rank method)
+ *
+ * The values aren't sorted, the value is found by binary search over the range of values
+ * with vectorised counting of values not greater than the middle.
+ *
+ * @param kernels Aggregation kernels to use
+ * @param values Array of values
+ * @param summary Summary of the values (from kernels->summarize())
+ * @param percentile Wanted percentile (0-100)
+ * @return The smallest value not lower than the percentile of the values
+ * @pre summary->count > 0
+ */
+int32_t aggregation_percentile(const struct aggregation_kernels *kernels, const int32_t *values,
+                               const struct load_summary *summary, unsigned percentile);
+
+#endif //HINFOSVC_AGGREGATION_H
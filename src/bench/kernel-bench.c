@@ -0,0 +1,134 @@
+/**
+ * @file kernel-bench.c
+ * Microbenchmark of aggregation kernels for CPU load history
+ *
+ * Kernels of all implementations supported by the CPU aggregate the same array of synthetic
+ * CPU load values (one day of samples taken once per second by default). Throughput of the summary
+ * and of the 95th percentile is reported per implementation.
+ *
+ * Usage: kernel-bench [-n ITERATIONS] [-s SAMPLES]
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../aggregation.h"
+
+/**
+ * Default number of iterations of each kernel
+ */
+#define DEFAULT_ITERATIONS 200
+/**
+ * Default number of aggregated values
+ */
+#define DEFAULT_SAMPLES 86400
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in seconds
+ */
+double now_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/**
+ * Measures kernels of one implementation
+ *
+ * @param kernels Implementation to measure
+ * @param values Aggregated values
+ * @param count Number of values
+ * @param iterations Number of iterations of each kernel
+ * @return Checksum of the results (it makes sure the kernels can't be optimized out)
+ */
+long long bench_kernels(const struct aggregation_kernels *kernels, const int32_t *values, size_t count,
+                        unsigned long iterations) {
+    struct load_summary summary = {0};
+    long long checksum = 0;
+    double summary_seconds, percentile_seconds;
+    double start;
+    int32_t p95 = 0;
+
+    start = now_seconds();
+    for (unsigned long i = 0; i < iterations; i++) {
+        kernels->summarize(values, count, &summary);
+        checksum += summary.sum + summary.min + summary.max;
+    }
+    summary_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    for (unsigned long i = 0; i < iterations; i++) {
+        p95 = aggregation_percentile(kernels, values, &summary, 95);
+        checksum += p95;
+    }
+    percentile_seconds = now_seconds() - start;
+
+    printf("%-8s %8.1f %6d %6d %4d %14.1f %14.1f\n", kernels->name, (double) summary.sum / (double) summary.count,
+           summary.min, summary.max, p95, (double) count * iterations / summary_seconds / 1e6,
+           (double) count * iterations / percentile_seconds / 1e6);
+
+    return checksum;
+}
+
+/**
+ * Init (main) function of the benchmark
+ *
+ * @param argc Number of CLI arguments
+ * @param argv CLI arguments as array of "strings"
+ * @return Program's exit code
+ */
+int main(int argc, char *argv[]) {
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    size_t count = DEFAULT_SAMPLES;
+    long long checksum = 0;
+    int32_t *values;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:s:")) != -1) {
+        if (option == 'n') {
+            iterations = strtoul(optarg, NULL, 10);
+        } else if (option == 's') {
+            count = strtoul(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [-n ITERATIONS] [-s SAMPLES]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (iterations == 0 || count == 0) {
+        fprintf(stderr, "Usage: %s [-n ITERATIONS] [-s SAMPLES]\n", argv[0]);
+        return 1;
+    }
+
+    if ((values = malloc(count * sizeof(*values))) == NULL) {
+        fprintf(stderr, "Cannot allocate values\n");
+        return 1;
+    }
+
+    // Mostly idle machine with occasional peaks
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = rand() % 100 < 90 ? rand() % 20 : rand() % 101;
+    }
+
+    printf("%-8s %8s %6s %6s %4s %14s %14s\n", "kernels", "avg", "min", "max", "p95", "summary M/s", "p95 M/s");
+
+    checksum += bench_kernels(&scalar_kernels, values, count, iterations);
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        checksum += bench_kernels(&avx2_kernels, values, count, iterations);
+    } else {
+        printf("%-8s (not supported by the CPU)\n", avx2_kernels.name);
+    }
+#endif
+    printf("checksum: %lld\n", checksum);
+
+    free(values);
+    return 0;
+}
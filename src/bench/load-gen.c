@@ -0,0 +1,507 @@
+/**
+ * @file load-gen.c
+ * Closed-loop HTTP load generator of the performance suite
+ *
+ * Every client keeps a batch of requests in flight (one request, or DEPTH requests when pipelining) and sends
+ * the next batch when the previous one is answered. Latency of a request is measured from sending of its batch
+ * to the end of its response. Routes are requested in turn, so more routes give a mixed workload.
+ *
+ * Modes: close (new connection per request), keep-alive (requests reuse the connection while the server keeps it)
+ * and pipeline (DEPTH requests are written at once). When the server closes the connection, the client waits
+ * for the close (so the generator doesn't collect TIME_WAIT entries), requests without response are counted
+ * as dropped and a new connection is opened.
+ *
+ * Usage: load-gen [-c CLIENTS] [-d SECONDS] [-m close|keep-alive|pipeline] [-p DEPTH] [-r ROUTE[,ROUTE]...] HOST:PORT
+ * Output: one line "REQUESTS_PER_SECOND P50_US P99_US DROPPED"
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#define _GNU_SOURCE // memmem(), strcasestr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+/**
+ * Maximum number of clients (connections open at once)
+ */
+#define MAX_CLIENTS 1024
+/**
+ * Maximum number of pipelined requests
+ */
+#define MAX_DEPTH 64
+/**
+ * Maximum number of requested routes
+ */
+#define MAX_ROUTES 16
+/**
+ * Maximum length of one request
+ */
+#define REQUEST_LEN 256
+/**
+ * Size of the buffer for responses (responses of the server are short)
+ */
+#define RESPONSE_BUFFER_LEN 16384
+/**
+ * Number of events handled by one call of epoll_wait()
+ */
+#define MAX_EVENTS 256
+
+/**
+ * Ways of using connections
+ */
+enum client_mode {
+    // New connection per request
+    CLOSE_M,
+    // Requests reuse the connection
+    KEEP_ALIVE_M,
+    // More requests are written at once
+    PIPELINE_M,
+};
+
+/**
+ * State of one client (connection with the batch of requests)
+ */
+struct client {
+    // Connection socket (-1 => not connected)
+    int fd;
+    // Requests of the batch
+    char output[MAX_DEPTH * REQUEST_LEN];
+    // Length of the requests
+    size_t output_length;
+    // Number of already sent bytes of the requests
+    size_t output_sent;
+    // Received part of responses (null terminated)
+    char input[RESPONSE_BUFFER_LEN + 1];
+    // Length of the received part
+    size_t input_length;
+    // Number of requests of the batch without response
+    unsigned pending;
+    // Does the server close the connection after the response?
+    bool server_closes;
+    // Time when the batch has been sent
+    double sent_at;
+};
+
+/**
+ * Options of the load generation
+ */
+struct load_options {
+    // Number of clients
+    unsigned clients;
+    // Duration of the measurement (in seconds)
+    double duration;
+    // Way of using connections
+    enum client_mode mode;
+    // Number of requests in one batch
+    unsigned depth;
+    // Requested routes
+    const char *routes[MAX_ROUTES];
+    // Number of routes
+    unsigned routes_count;
+    // Address of the server
+    struct sockaddr_storage address;
+    // Length of the address
+    socklen_t address_length;
+};
+
+/**
+ * Measured latencies of requests (in microseconds)
+ */
+static double *latencies = NULL;
+/**
+ * Number of measured latencies
+ */
+static size_t latencies_count = 0;
+/**
+ * Capacity of the array of latencies
+ */
+static size_t latencies_capacity = 0;
+/**
+ * Number of requests without response (the server closed the connection before answering them)
+ */
+static unsigned long dropped = 0;
+/**
+ * Index of the next requested route
+ */
+static unsigned next_route = 0;
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in seconds
+ */
+double now_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/**
+ * Saves latency of the answered request
+ *
+ * @param latency Latency in microseconds
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int record_latency(double latency) {
+    double *extended;
+
+    if (latencies_count == latencies_capacity) {
+        latencies_capacity = latencies_capacity == 0 ? 65536 : latencies_capacity * 2;
+        if ((extended = realloc(latencies, latencies_capacity * sizeof(*latencies))) == NULL) {
+            fprintf(stderr, "Cannot allocate memory for latencies\n");
+            return 1;
+        }
+        latencies = extended;
+    }
+
+    latencies[latencies_count++] = latency;
+    return 0;
+}
+
+/**
+ * Compares latencies (for qsort())
+ *
+ * @param a The first latency
+ * @param b The second latency
+ * @return Negative, zero or positive number as strcmp()
+ */
+int compare_latencies(const void *a, const void *b) {
+    double difference = *(const double *) a - *(const double *) b;
+
+    return (difference > 0) - (difference < 0);
+}
+
+/**
+ * Prepares the next batch of requests
+ *
+ * @param client Client to prepare the batch for
+ * @param options Options of the load generation
+ */
+void prepare_batch(struct client *client, const struct load_options *options) {
+    const char *connection = options->mode == CLOSE_M ? "close" : "keep-alive";
+
+    client->output_length = 0;
+    client->output_sent = 0;
+    for (unsigned i = 0; i < options->depth; i++) {
+        client->output_length += (size_t) snprintf(&client->output[client->output_length], REQUEST_LEN,
+                                                   "GET %s HTTP/1.1\r\nHost: perf\r\nConnection: %s\r\n\r\n",
+                                                   options->routes[next_route], connection);
+        next_route = (next_route + 1) % options->routes_count;
+    }
+
+    client->pending = options->depth;
+    client->sent_at = now_seconds();
+}
+
+/**
+ * Opens a new connection of the client and prepares the first batch
+ *
+ * @param client Client to connect
+ * @param epoll_fd Epoll instance watching clients
+ * @param options Options of the load generation
+ * @return 0 => success, 1 => error
+ */
+int connect_client(struct client *client, int epoll_fd, const struct load_options *options) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT, .data.ptr = client};
+
+    if ((client->fd = socket(options->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) {
+        fprintf(stderr, "Cannot create client socket\n");
+        return 1;
+    }
+
+    if ((connect(client->fd, (struct sockaddr *) &options->address, options->address_length) == -1
+         && errno != EINPROGRESS) || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event) == -1) {
+        fprintf(stderr, "Cannot connect to the server\n");
+        close(client->fd);
+        client->fd = -1;
+        return 1;
+    }
+
+    client->input_length = 0;
+    client->server_closes = false;
+    prepare_batch(client, options);
+
+    return 0;
+}
+
+/**
+ * Sends the rest of the batch
+ *
+ * @param client Client to send the batch of
+ * @param epoll_fd Epoll instance watching clients
+ * @return 0 => success (the batch may be sent partially), 1 => error (the connection is broken)
+ */
+int send_batch(struct client *client, int epoll_fd) {
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+    ssize_t sent;
+
+    while (client->output_sent < client->output_length) {
+        sent = send(client->fd, &client->output[client->output_sent], client->output_length - client->output_sent,
+                    MSG_NOSIGNAL);
+        if (sent == -1) {
+            return errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOTCONN;
+        }
+        client->output_sent += (size_t) sent;
+    }
+
+    // Writability isn't interesting until the next batch
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    return 0;
+}
+
+/**
+ * Takes complete responses from the received data
+ *
+ * @param client Client that received the data
+ * @param closed Has the server closed the connection? (responses without Content-Length end by the close)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int take_responses(struct client *client, bool closed) {
+    const char *head_end;
+    const char *length_header;
+    size_t response_length;
+
+    while (client->pending > 0 && (head_end = memmem(client->input, client->input_length, "\r\n\r\n", 4)) != NULL) {
+        response_length = (size_t) (head_end - client->input) + 4;
+
+        // The buffer is null terminated, but the header must be in the head of this response
+        length_header = strcasestr(client->input, "\r\nContent-Length:");
+        if (length_header != NULL && length_header < head_end) {
+            response_length += strtoul(length_header + strlen("\r\nContent-Length:"), NULL, 10);
+        } else if (closed) {
+            response_length = client->input_length;
+        } else {
+            return 0;
+        }
+
+        if (response_length > client->input_length) {
+            return 0;
+        }
+
+        if (strcasestr(client->input, "\r\nConnection: close") != NULL) {
+            client->server_closes = true;
+        }
+        if (record_latency((now_seconds() - client->sent_at) * 1e6) != 0) {
+            return 1;
+        }
+
+        client->pending--;
+        client->input_length -= response_length;
+        memmove(client->input, &client->input[response_length], client->input_length);
+        client->input[client->input_length] = '\0';
+    }
+
+    return 0;
+}
+
+/**
+ * Reads responses of the client and sends the next batch when the previous one is answered
+ *
+ * @param client Client with readable socket
+ * @param epoll_fd Epoll instance watching clients
+ * @param options Options of the load generation
+ * @return 0 => success, 1 => error
+ */
+int read_client(struct client *client, int epoll_fd, const struct load_options *options) {
+    ssize_t received;
+    bool closed = false;
+
+    while (!closed) {
+        received = recv(client->fd, &client->input[client->input_length], RESPONSE_BUFFER_LEN - client->input_length,
+                        0);
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // Reset connection is closed as well (the server may not read pipelined requests it doesn't answer)
+        closed = received <= 0;
+        client->input_length += closed ? 0 : (size_t) received;
+        client->input[client->input_length] = '\0';
+
+        if (take_responses(client, closed) != 0) {
+            return 1;
+        }
+        if (!closed && client->input_length == RESPONSE_BUFFER_LEN) {
+            fprintf(stderr, "Response is too long\n");
+            return 1;
+        }
+    }
+
+    if (closed) {
+        dropped += client->pending;
+        close(client->fd);
+        return connect_client(client, epoll_fd, options);
+    }
+
+    // The server will close the connection, its close is waited for
+    if (client->pending > 0 || options->mode == CLOSE_M || client->server_closes) {
+        return 0;
+    }
+
+    prepare_batch(client, options);
+    return send_batch(client, epoll_fd);
+}
+
+/**
+ * Parses the address of the server
+ *
+ * @param spec Address as HOST:PORT
+ * @param options Options to save the address to
+ * @return 0 => success, 1 => error
+ */
+int parse_address(const char *spec, struct load_options *options) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    char host[256];
+    const char *port = strrchr(spec, ':');
+
+    if (port == NULL || (size_t) (port - spec) >= sizeof(host)) {
+        fprintf(stderr, "Address of the server must be HOST:PORT\n");
+        return 1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int) (port - spec), spec);
+
+    if (getaddrinfo(host, port + 1, &hints, &result) != 0) {
+        fprintf(stderr, "Cannot resolve address of the server: %s\n", spec);
+        return 1;
+    }
+
+    memcpy(&options->address, result->ai_addr, result->ai_addrlen);
+    options->address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+/**
+ * Loads options from CLI arguments
+ *
+ * @param argc Number of CLI arguments
+ * @param argv CLI arguments
+ * @param options Pointer to the place where to save the options
+ * @return 0 => success, 1 => error
+ */
+int load_options(int argc, char *argv[], struct load_options *options) {
+    char *route;
+    int option;
+
+    options->clients = 32;
+    options->duration = 3;
+    options->mode = CLOSE_M;
+    options->depth = 8;
+    options->routes[0] = "/hostname";
+    options->routes_count = 1;
+
+    while ((option = getopt(argc, argv, "c:d:m:p:r:")) != -1) {
+        switch (option) {
+            case 'c':
+                options->clients = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                options->duration = strtod(optarg, NULL);
+                break;
+            case 'm':
+                options->mode = strcmp(optarg, "keep-alive") == 0 ? KEEP_ALIVE_M
+                                : strcmp(optarg, "pipeline") == 0 ? PIPELINE_M : CLOSE_M;
+                break;
+            case 'p':
+                options->depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options->routes_count = 0;
+                for (route = strtok(optarg, ","); route != NULL && options->routes_count < MAX_ROUTES;
+                     route = strtok(NULL, ",")) {
+                    options->routes[options->routes_count++] = route;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (options->mode != PIPELINE_M) {
+        options->depth = 1;
+    }
+
+    if (optind >= argc || options->clients == 0 || options->clients > MAX_CLIENTS || options->duration <= 0
+        || options->depth == 0 || options->depth > MAX_DEPTH || options->routes_count == 0) {
+        return 1;
+    }
+
+    return parse_address(argv[optind], options);
+}
+
+int main(int argc, char *argv[]) {
+    struct epoll_event events[MAX_EVENTS];
+    struct load_options options;
+    struct client *clients;
+    struct client *client;
+    double start, elapsed;
+    int epoll_fd;
+    int count;
+    int result = 0;
+
+    if (load_options(argc, argv, &options) != 0) {
+        fprintf(stderr, "Usage: %s [-c CLIENTS] [-d SECONDS] [-m close|keep-alive|pipeline] [-p DEPTH] "
+                        "[-r ROUTE[,ROUTE]...] HOST:PORT\n", argv[0]);
+        return 1;
+    }
+
+    if ((clients = calloc(options.clients, sizeof(*clients))) == NULL || (epoll_fd = epoll_create1(0)) == -1) {
+        fprintf(stderr, "Cannot allocate clients\n");
+        free(clients);
+        return 1;
+    }
+
+    start = now_seconds();
+    for (unsigned i = 0; i < options.clients && result == 0; i++) {
+        result = connect_client(&clients[i], epoll_fd, &options);
+    }
+
+    while (result == 0 && now_seconds() - start < options.duration) {
+        if ((count = epoll_wait(epoll_fd, events, MAX_EVENTS, 100)) == -1 && errno != EINTR) {
+            result = 1;
+        }
+
+        for (int i = 0; i < count && result == 0; i++) {
+            client = events[i].data.ptr;
+            if (events[i].events & EPOLLOUT) {
+                result = send_batch(client, epoll_fd);
+            }
+            if (result == 0 && events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                result = read_client(client, epoll_fd, &options);
+            }
+        }
+    }
+    elapsed = now_seconds() - start;
+
+    for (unsigned i = 0; i < options.clients; i++) {
+        if (clients[i].fd != -1) {
+            close(clients[i].fd);
+        }
+    }
+    close(epoll_fd);
+    free(clients);
+
+    if (result != 0 || latencies_count == 0) {
+        fprintf(stderr, "Load generation failed (%zu responses)\n", latencies_count);
+        free(latencies);
+        return 1;
+    }
+
+    qsort(latencies, latencies_count, sizeof(*latencies), compare_latencies);
+    printf("%.0f %.0f %.0f %lu\n", (double) latencies_count / elapsed, latencies[latencies_count / 2],
+           latencies[(size_t) ((double) latencies_count * 0.99)], dropped);
+
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file parser-bench.c
+ * Microbenchmark of the HTTP request loading FSM and parse_http_request()
+ *
+ * Every file in the corpus directory is one raw HTTP request. Each request is parsed
+ * repeatedly (in memory, no socket is used) and throughput is reported per file and in total.
+ *
+ * Usage: parser-bench [-n ITERATIONS] CORPUS_DIR
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "../http-processing.h"
+
+/**
+ * Maximum number of corpus files
+ */
+#define MAX_CORPUS_FILES 256
+/**
+ * Maximum size of a single corpus file
+ */
+#define MAX_CORPUS_FILE_LEN (64 * 1024)
+/**
+ * Default number of iterations over each corpus file
+ */
+#define DEFAULT_ITERATIONS 200000
+
+/**
+ * Single request of the corpus
+ */
+struct corpus_item {
+    char name[NAME_MAX + 1];
+    char *data;
+    size_t length;
+};
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in seconds
+ */
+double now_seconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/**
+ * Loads all files from the corpus directory
+ *
+ * @param path Path to the corpus directory
+ * @param items Array where to save loaded requests
+ * @return Number of loaded requests, -1 => error
+ */
+int load_corpus(const char *path, struct corpus_item *items) {
+    char file_path[PATH_MAX];
+    struct dirent *entry;
+    DIR *directory;
+    FILE *file;
+    int count = 0;
+
+    if ((directory = opendir(path)) == NULL) {
+        fprintf(stderr, "Cannot open corpus directory %s\n", path);
+        return -1;
+    }
+
+    while ((entry = readdir(directory)) != NULL && count < MAX_CORPUS_FILES) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        if ((file = fopen(file_path, "rb")) == NULL) {
+            fprintf(stderr, "Cannot open corpus file %s\n", file_path);
+            continue;
+        }
+
+        if ((items[count].data = malloc(MAX_CORPUS_FILE_LEN)) == NULL) {
+            fprintf(stderr, "Cannot allocate memory for corpus file %s\n", file_path);
+            fclose(file);
+            closedir(directory);
+            for (int i = 0; i < count; i++) {
+                free(items[i].data);
+            }
+            return -1;
+        }
+        items[count].length = fread(items[count].data, 1, MAX_CORPUS_FILE_LEN, file);
+        strcpy(items[count].name, entry->d_name);
+        fclose(file);
+
+        count++;
+    }
+
+    closedir(directory);
+    return count;
+}
+
+/**
+ * Compares corpus items by their names (for qsort)
+ *
+ * @param a The first item
+ * @param b The second item
+ * @return Result of comparison (see strcmp)
+ */
+int compare_items(const void *a, const void *b) {
+    return strcmp(((const struct corpus_item *) a)->name, ((const struct corpus_item *) b)->name);
+}
+
+/**
+ * Init (main) function of the benchmark
+ *
+ * @param argc Number of CLI arguments
+ * @param argv CLI arguments as array of "strings"
+ * @return Program's exit code
+ */
+int main(int argc, char *argv[]) {
+    struct corpus_item items[MAX_CORPUS_FILES];
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    unsigned long checksum = 0;
+    double total_seconds = 0;
+    double total_bytes = 0;
+    double total_requests = 0;
+    double start, elapsed;
+    unsigned status;
+    int count;
+    int option;
+    struct http_request_line request;
+
+    while ((option = getopt(argc, argv, "n:")) != -1) {
+        if (option == 'n') {
+            iterations = strtoul(optarg, NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [-n ITERATIONS] CORPUS_DIR\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || iterations == 0) {
+        fprintf(stderr, "Usage: %s [-n ITERATIONS] CORPUS_DIR\n", argv[0]);
+        return 1;
+    }
+
+    if ((count = load_corpus(argv[optind], items)) <= 0) {
+        fprintf(stderr, "Corpus is empty\n");
+        return 1;
+    }
+    qsort(items, count, sizeof(items[0]), compare_items);
+
+    printf("%-32s %6s %8s %14s %12s\n", "request", "status", "bytes", "requests/s", "MB/s");
+
+    for (int i = 0; i < count; i++) {
+        status = 0;
+        start = now_seconds();
+
+        for (unsigned long j = 0; j < iterations; j++) {
+            status = parse_http_message(items[i].data, items[i].length, &request);
+            checksum += status;
+        }
+
+        elapsed = now_seconds() - start;
+        total_seconds += elapsed;
+        total_bytes += (double) items[i].length * iterations;
+        total_requests += (double) iterations;
+
+        printf("%-32s %6u %8zu %14.0f %12.1f\n", items[i].name, status, items[i].length, iterations / elapsed,
+               (double) items[i].length * iterations / elapsed / 1e6);
+    }
+
+    printf("%-32s %6s %8.0f %14.0f %12.1f\n", "TOTAL", "", total_bytes / total_requests,
+           total_requests / total_seconds, total_bytes / total_seconds / 1e6);
+    // Checksum makes sure the parsing can't be optimized out
+    printf("checksum: %lu\n", checksum);
+
+    for (int i = 0; i < count; i++) {
+        free(items[i].data);
+    }
+
+    return 0;
+}
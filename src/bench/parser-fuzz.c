@@ -0,0 +1,42 @@
+/**
+ * @file parser-fuzz.c
+ * libFuzzer target for the HTTP request loading FSM and parse_http_request()
+ *
+ * The whole input is fed to parse_http_message() at once and then once more split
+ * into two parts, so the incremental loading of the FSM is covered as well.
+ *
+ * Usage: parser-fuzz [libFuzzer options] CORPUS_DIR
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "../http-processing.h"
+
+/**
+ * Entry point called by libFuzzer for every generated input
+ *
+ * @param data Generated input
+ * @param size Size of the input
+ * @return Always 0 (the input is acceptable for the corpus)
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    struct http_request_line request;
+    struct http_parser parser;
+    size_t consumed;
+    size_t split;
+
+    parse_http_message((const char *) data, size, &request);
+
+    // The same input delivered in two reads (the parser works in place, so both parts are in the same buffer)
+    split = size > 0 ? data[0] % size : 0;
+    http_parser_init(&parser, (const char *) data, size);
+    if (http_parser_feed(&parser, split, &consumed) == 3) {
+        if (http_parser_feed(&parser, size - split, &consumed) == 0) {
+            parse_http_request(parser.head, parser.line_length, &request);
+        }
+    }
+
+    return 0;
+}
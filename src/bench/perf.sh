@@ -0,0 +1,129 @@
+#!/bin/sh
+# perf.sh
+#
+# Performance regression suite: runs the server against the synthetic /proc fixture, drives it by the load
+# generator through the matrix of scenarios and compares requests per second and p99 latency with the baseline.
+# Any request dropped by the server (connection closed or reset without the response) fails the suite.
+#
+# Author: Michal Šmahel (xsmahe01)
+#
+# Usage: perf.sh SERVER LOAD_GEN FIXTURE BASELINE [update|train]
+#   update ... save measured values as the new baseline instead of comparing
+#   train  ... just run the scenarios (training of profile-guided optimization, BASELINE isn't used)
+#
+# Environment:
+#   PERF_THRESHOLD ... allowed regression in percent (default: 10)
+#   PERF_DURATION  ... duration of one scenario in seconds (default: 3)
+#   PERF_CLIENTS   ... number of concurrent clients (default: 32)
+#   PERF_PORT      ... port of the server (default: 18080)
+
+SERVER=$1
+LOAD_GEN=$2
+FIXTURE=$3
+BASELINE=$4
+MODE=${5:-compare}
+THRESHOLD=${PERF_THRESHOLD:-10}
+DURATION=${PERF_DURATION:-3}
+CLIENTS=${PERF_CLIENTS:-32}
+PORT=${PERF_PORT:-18080}
+
+if [ -z "$BASELINE" ]; then
+    echo "Usage: $0 SERVER LOAD_GEN FIXTURE BASELINE [update|train]" >&2
+    exit 1
+fi
+
+# The fixture is copied, so its stat file can be advanced without touching the bundled one
+WORK_DIR=$(mktemp -d)
+cp -R "$FIXTURE"/. "$WORK_DIR"
+RESULTS="$WORK_DIR/results"
+
+# CPU counters must move, otherwise no sample of CPU load can be computed
+(
+    tick=0
+    while :; do
+        tick=$((tick + 1))
+        printf 'cpu  %d 0 %d %d 0 0 0 0 0 0\n' $((10000 + tick * 30)) $((5000 + tick * 10)) \
+            $((80000 + tick * 60)) >"$WORK_DIR/stat.new"
+        mv "$WORK_DIR/stat.new" "$WORK_DIR/stat"
+        sleep 0.1
+    done
+) &
+TICKER=$!
+
+"$SERVER" -P "$WORK_DIR" -l "127.0.0.1:$PORT" &
+SERVER_PID=$!
+
+# The server is stopped by SIGINT like by the user, so it exits normally (and writes PGO profiles)
+cleanup() {
+    kill "$TICKER" 2>/dev/null
+    kill -INT "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+# Wait for the first sample of CPU load, so the scenarios don't measure the start of the server
+sleep 1
+if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+    echo "Server hasn't started" >&2
+    exit 1
+fi
+
+# Scenario: name, mode of connections and routes
+run_scenario() {
+    printf '%-16s ' "$1"
+    if ! result=$("$LOAD_GEN" -c "$CLIENTS" -d "$DURATION" -m "$2" -r "$3" "127.0.0.1:$PORT"); then
+        echo "failed"
+        return 1
+    fi
+    echo "$result"
+    echo "$1 $result" >>"$RESULTS"
+}
+
+# The server answers every request with "Connection: close", so keep-alive and pipelined modes of the load
+# generator would measure connection per request as well (pipelined requests are even reset), they aren't
+# scenarios of the suite until the server keeps connections open
+printf '%-16s %s\n' "scenario" "requests/s p50_us p99_us dropped"
+run_scenario close close /hostname || exit 1
+run_scenario mixed close /hostname,/cpu-name,/load,/load/history,/stats/listeners || exit 1
+
+if [ "$MODE" = "train" ]; then
+    exit 0
+fi
+
+# Numbers of a scenario that drops requests don't describe the serving path (neither as a baseline)
+if ! awk '$5 != 0 { printf "DROPPED %s: %d requests\n", $1, $5; failed = 1 } END { exit failed }' "$RESULTS"; then
+    exit 1
+fi
+
+if [ "$MODE" = "update" ]; then
+    {
+        echo "# scenario requests/s p99_us (make perf-baseline)"
+        awk '{ print $1, $2, $4 }' "$RESULTS"
+    } >"$BASELINE"
+    echo "Baseline saved to $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline in $BASELINE (create it by: make perf-baseline)" >&2
+    exit 1
+fi
+
+# Requests per second mustn't drop and p99 latency mustn't grow more than the threshold
+awk -v threshold="$THRESHOLD" '
+    FNR == NR && !/^#/ { rps[$1] = $2; p99[$1] = $3; next }
+    FNR != NR && ($1 in rps) {
+        if ($2 < rps[$1] * (1 - threshold / 100)) {
+            printf "REGRESSION %s: %d requests/s (baseline %d)\n", $1, $2, rps[$1]
+            failed = 1
+        }
+        if ($4 > p99[$1] * (1 + threshold / 100)) {
+            printf "REGRESSION %s: p99 %d us (baseline %d us)\n", $1, $4, p99[$1]
+            failed = 1
+        }
+    }
+    END { exit failed }
+' "$BASELINE" "$RESULTS" || exit 1
+
+echo "No regression over $THRESHOLD % against $BASELINE"
@@ -0,0 +1,367 @@
+/**
+ * @file config.c
+ * Server configuration loader
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#define _GNU_SOURCE // cpu_set_t
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "config.h"
+#include "http-processing.h"
+#include "system-info.h"
+#include "offload.h"
+
+/**
+ * Prints short usage of the program
+ *
+ * @param program Name of the program (argv[0])
+ */
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-t] [-i SECONDS] [-l ENDPOINT]... [-u PATH] [-H FILE] [-r RATE[:BURST]] [-w WORKERS]\n"
+                    "       [-a CPUS[,CPUS]...] [-S CPUS|spare] [-L SECONDS] [-C] [-M LINE[:HEADERS]] [-P DIR]\n"
+                    "       [-A CONNS[:LOAD[:DELAY]]] [-T MS] [-O THREADS] [PORT]\n", program);
+    fprintf(stderr, "  PORT          listen on the port of all IPv4 and IPv6 addresses (same as -l *:PORT)\n");
+    fprintf(stderr, "  -l ENDPOINT   listen on the endpoint: IPV4:PORT, [IPV6]:PORT, *:PORT or unix:PATH (repeatable)\n");
+    fprintf(stderr, "  -t            enable per-request tracing (available at /debug/trace?seconds=N)\n");
+    fprintf(stderr, "  -i SECONDS    sampling interval of CPU load (default: %d)\n", DEFAULT_LOAD_SAMPLE_INTERVAL);
+    fprintf(stderr, "  -u PATH       listen on UNIX domain socket (same as -l unix:PATH, @name => abstract namespace)\n");
+    fprintf(stderr, "  -H FILE       keep history of CPU load in the file (survives restarts)\n");
+    fprintf(stderr, "  -r RATE[:BURST] limit requests per second per client address (burst defaults to RATE), the limit\n"
+                    "                is shared by all workers, not multiplied by -w\n");
+    fprintf(stderr, "  -w WORKERS    number of parallel event loops (default: 1, at most %d)\n", MAX_WORKERS);
+    fprintf(stderr, "  -a CPUS,...   pin workers in turn to CPUS: CPU, CPU-CPU or nodeN (all CPUs of NUMA node)\n");
+    fprintf(stderr, "  -S CPUS       pin the sampler to CPUS (spare => CPUs not used by workers)\n");
+    fprintf(stderr, "  -L SECONDS    sample CPU load only until no /load is requested for SECONDS (lazy sampling)\n");
+    fprintf(stderr, "  -C            no sampler, concurrent /load requests share one measuring window (coalescing)\n");
+    fprintf(stderr, "  -M LINE[:HEADERS] maximum length of request line and headers in bytes (default: %d:%d)\n",
+            DEFAULT_MAX_REQUEST_LINE, DEFAULT_MAX_HEADERS);
+    fprintf(stderr, "  -P DIR        read system information from DIR instead of %s (synthetic fixtures)\n",
+            DEFAULT_PROC_ROOT);
+    fprintf(stderr, "  -A CONNS[:LOAD[:DELAY]] answer 503 over CONNS connections, LOAD requests waiting for CPU load\n"
+                    "                or DELAY ms of queueing per worker (0 => no limit)\n");
+    fprintf(stderr, "  -T MS         wait up to MS milliseconds for the client to close first (avoids TIME_WAIT)\n");
+    fprintf(stderr, "  -O THREADS    threads for blocking collectors (default: %d, at most %d, 0 => run by workers)\n",
+            DEFAULT_OFFLOAD_THREADS, MAX_OFFLOAD_THREADS);
+}
+
+/**
+ * Parses the port number
+ *
+ * @param port_str Port as a string
+ * @param port Pointer to the place where to save the port
+ * @return 0 => success, 1 => error (invalid port)
+ */
+int parse_port(const char *port_str, unsigned *port) {
+    char *port_end;
+
+    *port = strtoul(port_str, &port_end, 10);
+    if (*port < 1025 || *port > 65535 || *port_end != '\0') {
+        fprintf(stderr, "Port must be a number 1025-65535 (0-1024 are protected by OS)\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Adds the listen endpoint to the configuration
+ *
+ * @param spec Specification of the endpoint: IPV4:PORT, [IPV6]:PORT, *:PORT (all addresses) or unix:PATH
+ * @param config Configuration to add the endpoint to
+ * @return 0 => success, 1 => error (invalid specification or too many endpoints)
+ */
+int add_endpoint(const char *spec, struct server_config *config) {
+    struct listen_endpoint *endpoint = &config->endpoints[config->endpoints_count];
+    struct sockaddr_in *ipv4 = (struct sockaddr_in *) &endpoint->address;
+    struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *) &endpoint->address;
+    char host[LISTENER_NAME_LEN + 1];
+    const char *port_str = strrchr(spec, ':');
+    size_t host_length;
+    unsigned port;
+
+    if (config->endpoints_count >= MAX_LISTENERS || strlen(spec) > LISTENER_NAME_LEN) {
+        fprintf(stderr, "Too many or too long endpoints (at most %d endpoints)\n", MAX_LISTENERS);
+        return 1;
+    }
+
+    memset(endpoint, 0, sizeof(*endpoint));
+    strcpy(endpoint->name, spec);
+
+    if (strncmp(spec, "unix:", 5) == 0 && spec[5] != '\0') {
+        endpoint->type = UNIX_E;
+        endpoint->path = &spec[5];
+        config->endpoints_count++;
+        return 0;
+    }
+
+    if (port_str == NULL) {
+        fprintf(stderr, "Endpoint %s has no port\n", spec);
+        return 1;
+    }
+    if (parse_port(port_str + 1, &port) != 0) {
+        return 1;
+    }
+
+    host_length = (size_t) (port_str - spec);
+    memcpy(host, spec, host_length);
+    host[host_length] = '\0';
+
+    endpoint->type = TCP_E;
+    if (host_length == 0 || strcmp(host, "*") == 0) {
+        // All addresses, IPv4 ones are mapped to IPv6
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_addr = in6addr_any;
+        ipv6->sin6_port = htons(port);
+        endpoint->address_length = sizeof(*ipv6);
+        endpoint->dual_stack = true;
+    } else if (host[0] == '[' && host[host_length - 1] == ']') {
+        host[host_length - 1] = '\0';
+        ipv6->sin6_family = AF_INET6;
+        ipv6->sin6_port = htons(port);
+        endpoint->address_length = sizeof(*ipv6);
+        if (inet_pton(AF_INET6, &host[1], &ipv6->sin6_addr) != 1) {
+            fprintf(stderr, "Invalid IPv6 address of endpoint %s\n", spec);
+            return 1;
+        }
+    } else {
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(port);
+        endpoint->address_length = sizeof(*ipv4);
+        if (inet_pton(AF_INET, host, &ipv4->sin_addr) != 1) {
+            fprintf(stderr, "Invalid IPv4 address of endpoint %s\n", spec);
+            return 1;
+        }
+    }
+
+    config->endpoints_count++;
+    return 0;
+}
+
+/**
+ * Parses placements of workers
+ *
+ * @param list Comma separated list of placements (see affinity_parse())
+ * @param config Configuration to save the placements to
+ * @return 0 => success, 1 => error (invalid list or too many placements)
+ */
+int parse_worker_affinities(const char *list, struct server_config *config) {
+    const char *end = list;
+
+    config->worker_affinities_count = 0;
+    do {
+        if (config->worker_affinities_count >= MAX_WORKERS) {
+            fprintf(stderr, "Too many placements of workers (maximum is %d)\n", MAX_WORKERS);
+            return 1;
+        }
+        if (affinity_parse(end, &config->worker_affinities[config->worker_affinities_count++], &end) != 0) {
+            return 1;
+        }
+    } while (*end++ == ',');
+
+    if (end[-1] != '\0') {
+        fprintf(stderr, "Placements of workers must be a comma separated list: %s\n", list);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Loads the server configuration from CLI arguments
+ *
+ * @param argc Number of CLI arguments
+ * @param argv CLI arguments as array of "strings"
+ * @param config Pointer to the place where to save loaded configuration
+ * @return 0 => success, 1 => error (invalid arguments)
+ */
+int load_config(int argc, char *argv[], struct server_config *config) {
+    char endpoint[LISTENER_NAME_LEN + 1];
+    const char *affinity_end;
+    char *value_end;
+    bool sampler_spare = false;
+    unsigned port;
+    int option;
+
+    // Default values
+    config->endpoints_count = 0;
+    config->trace = false;
+    config->load_interval = DEFAULT_LOAD_SAMPLE_INTERVAL;
+    config->history_path = NULL;
+    config->rate_limit = 0;
+    config->rate_burst = 0;
+    config->workers = 1;
+    config->worker_affinities_count = 0;
+    config->sampler_pinned = false;
+    config->idle_window = 0;
+    config->coalesce = false;
+    config->max_request_line = DEFAULT_MAX_REQUEST_LINE;
+    config->max_headers = DEFAULT_MAX_HEADERS;
+    config->proc_root = DEFAULT_PROC_ROOT;
+    config->max_connections = 0;
+    config->max_waiting = 0;
+    config->max_delay = 0;
+    config->linger_timeout = 0;
+    config->offload_threads = DEFAULT_OFFLOAD_THREADS;
+
+    while ((option = getopt(argc, argv, "ti:l:u:H:r:w:a:S:L:CM:P:A:T:O:")) != -1) {
+        switch (option) {
+            case 't':
+                config->trace = true;
+                break;
+            case 'i':
+                config->load_interval = strtoul(optarg, NULL, 10);
+                if (config->load_interval == 0) {
+                    fprintf(stderr, "Sampling interval must be a positive number of seconds\n");
+                    return 1;
+                }
+                break;
+            case 'l':
+                if (add_endpoint(optarg, config) != 0) {
+                    return 1;
+                }
+                break;
+            case 'u':
+                snprintf(endpoint, sizeof(endpoint), "unix:%s", optarg);
+                if (add_endpoint(endpoint, config) != 0) {
+                    return 1;
+                }
+                // The endpoint must point to the argument, not to the temporary name
+                config->endpoints[config->endpoints_count - 1].path = optarg;
+                break;
+            case 'H':
+                config->history_path = optarg;
+                break;
+            case 'r':
+                config->rate_limit = strtoul(optarg, &value_end, 10);
+                config->rate_burst = *value_end == ':' ? strtoul(value_end + 1, &value_end, 10) : config->rate_limit;
+                if (config->rate_limit == 0 || config->rate_limit > MAX_RATE_LIMIT || config->rate_burst == 0
+                    || config->rate_burst > MAX_RATE_LIMIT || *value_end != '\0') {
+                    fprintf(stderr, "Rate limit must be RATE[:BURST] with numbers 1-%d\n", MAX_RATE_LIMIT);
+                    return 1;
+                }
+                break;
+            case 'w':
+                config->workers = strtoul(optarg, &value_end, 10);
+                if (config->workers == 0 || config->workers > MAX_WORKERS || *value_end != '\0') {
+                    fprintf(stderr, "Number of workers must be a number 1-%d\n", MAX_WORKERS);
+                    return 1;
+                }
+                break;
+            case 'a':
+                if (parse_worker_affinities(optarg, config) != 0) {
+                    return 1;
+                }
+                break;
+            case 'S':
+                // Spare CPUs depend on placements of workers, so they are computed after loading all options
+                sampler_spare = strcmp(optarg, "spare") == 0;
+                config->sampler_pinned = true;
+                if (!sampler_spare && (affinity_parse(optarg, &config->sampler_affinity, &affinity_end) != 0
+                                       || *affinity_end != '\0')) {
+                    fprintf(stderr, "Placement of the sampler must be CPU, CPU-CPU, nodeN or spare\n");
+                    return 1;
+                }
+                break;
+            case 'L':
+                config->idle_window = strtoul(optarg, &value_end, 10);
+                if (config->idle_window == 0 || *value_end != '\0') {
+                    fprintf(stderr, "Idle window of lazy sampling must be a positive number of seconds\n");
+                    return 1;
+                }
+                break;
+            case 'C':
+                config->coalesce = true;
+                break;
+            case 'M':
+                config->max_request_line = strtoul(optarg, &value_end, 10);
+                config->max_headers = *value_end == ':' ? strtoul(value_end + 1, &value_end, 10)
+                                                        : DEFAULT_MAX_HEADERS;
+                if (config->max_request_line < MIN_HTTP_LIMIT || config->max_request_line > MAX_HTTP_LIMIT
+                    || config->max_headers < MIN_HTTP_LIMIT || config->max_headers > MAX_HTTP_LIMIT
+                    || *value_end != '\0') {
+                    fprintf(stderr, "Request limits must be LINE[:HEADERS] with numbers %d-%d\n", MIN_HTTP_LIMIT,
+                            MAX_HTTP_LIMIT);
+                    return 1;
+                }
+                break;
+            case 'P':
+                config->proc_root = optarg;
+                break;
+            case 'A':
+                config->max_connections = strtoul(optarg, &value_end, 10);
+                config->max_waiting = *value_end == ':' ? strtoul(value_end + 1, &value_end, 10) : 0;
+                config->max_delay = *value_end == ':' ? strtoul(value_end + 1, &value_end, 10) : 0;
+                if (*value_end != '\0' || *optarg < '0' || *optarg > '9' || config->max_delay > MAX_ADMISSION_DELAY) {
+                    fprintf(stderr, "Admission limits must be CONNS[:LOAD[:DELAY]] with numbers (DELAY at most %d)\n",
+                            MAX_ADMISSION_DELAY);
+                    return 1;
+                }
+                break;
+            case 'T':
+                config->linger_timeout = strtoul(optarg, &value_end, 10);
+                if (config->linger_timeout == 0 || config->linger_timeout > MAX_LINGER_TIMEOUT || *value_end != '\0') {
+                    fprintf(stderr, "Linger timeout must be a number 1-%d (milliseconds)\n", MAX_LINGER_TIMEOUT);
+                    return 1;
+                }
+                break;
+            case 'O':
+                config->offload_threads = strtoul(optarg, &value_end, 10);
+                if (config->offload_threads > MAX_OFFLOAD_THREADS || *value_end != '\0' || *optarg == '\0') {
+                    fprintf(stderr, "Number of offload threads must be a number 0-%d\n", MAX_OFFLOAD_THREADS);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Port is optional positional argument (for compatibility), at least one endpoint is required
+    if (optind < argc) {
+        if (parse_port(argv[optind], &port) != 0) {
+            return 1;
+        }
+        snprintf(endpoint, sizeof(endpoint), "*:%u", port);
+        if (add_endpoint(endpoint, config) != 0) {
+            return 1;
+        }
+    }
+
+    if (config->endpoints_count == 0) {
+        fprintf(stderr, "You need to specify a port. For example: %s 12345\n", argv[0]);
+        return 1;
+    }
+
+    // Coalescing event loops measure CPU load themselves, there is no sampler thread
+    if (config->coalesce && (config->idle_window > 0 || config->sampler_pinned)) {
+        fprintf(stderr, "Coalescing (-C) can't be combined with lazy (-L) or pinned (-S) sampler\n");
+        return 1;
+    }
+
+    // Open streams demand samples once per interval, the sampler mustn't stop between them
+    if (config->idle_window > 0 && config->idle_window <= config->load_interval) {
+        fprintf(stderr, "Idle window of lazy sampling must be longer than the sampling interval\n");
+        return 1;
+    }
+
+    // The sampler measures CPUs of workers, so it can stay off them
+    if (sampler_spare) {
+        if (config->worker_affinities_count == 0) {
+            fprintf(stderr, "Spare CPUs for the sampler need pinned workers (-a)\n");
+            return 1;
+        }
+        if (affinity_spare(config->worker_affinities, config->worker_affinities_count < config->workers
+                                                      ? config->worker_affinities_count : config->workers,
+                           &config->sampler_affinity) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef HINFOSVC_CONFIG_H
+#define HINFOSVC_CONFIG_H
+/**
+ * @file config.h
+ * Header of server configuration loader
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include <sys/socket.h>
+#include "listener-stats.h"
+#include "affinity.h"
+
+/**
+ * Maximum rate limit and burst (buckets count thousandths of tokens in 32 bits)
+ */
+#define MAX_RATE_LIMIT 1000000
+/**
+ * Maximum number of workers (event loops running in parallel)
+ */
+#define MAX_WORKERS 64
+/**
+ * Bounds of limits of the request line and of the header section (buffer for both is allocated per connection)
+ */
+#define MIN_HTTP_LIMIT 16
+#define MAX_HTTP_LIMIT 65536
+/**
+ * Maximum queueing delay of admission control (in milliseconds)
+ */
+#define MAX_ADMISSION_DELAY 60000
+/**
+ * Maximum time for closing the connection by the client (in milliseconds)
+ */
+#define MAX_LINGER_TIMEOUT 60000
+
+/**
+ * Types of listen endpoints
+ */
+enum endpoint_type {
+    // TCP socket (IPv4 or IPv6)
+    TCP_E,
+    // UNIX domain socket
+    UNIX_E,
+};
+
+/**
+ * Endpoint to listen on
+ */
+struct listen_endpoint {
+    // Name of the endpoint (as it has been specified, used for statistics)
+    char name[LISTENER_NAME_LEN + 1];
+    // Type of the endpoint
+    enum endpoint_type type;
+    // Address to bind to (TCP endpoints)
+    struct sockaddr_storage address;
+    // Length of the address (TCP endpoints)
+    socklen_t address_length;
+    // Does the IPv6 socket accept IPv4 connections too? (TCP endpoints)
+    bool dual_stack;
+    // Path of the socket (UNIX endpoints, @ prefix => abstract namespace)
+    const char *path;
+};
+
+/**
+ * Configuration of the server (loaded from CLI arguments)
+ */
+struct server_config {
+    // Endpoints to listen on
+    struct listen_endpoint endpoints[MAX_LISTENERS];
+    // Number of endpoints
+    unsigned endpoints_count;
+    // Is per-request tracing on?
+    bool trace;
+    // Sampling interval of CPU load (in seconds)
+    unsigned load_interval;
+    // Path of the file with history of CPU load (NULL => history is kept in memory only)
+    const char *history_path;
+    // Number of requests per second allowed for one client address (0 => no limiting)
+    unsigned rate_limit;
+    // Number of requests allowed for one client address at once
+    unsigned rate_burst;
+    // Number of workers (event loops running in their own threads)
+    unsigned workers;
+    // Placements of workers (workers take them in turn)
+    struct cpu_affinity worker_affinities[MAX_WORKERS];
+    // Number of placements of workers (0 => workers aren't pinned)
+    unsigned worker_affinities_count;
+    // Do event loops measure CPU load themselves? (requests are parked until the end of the measuring window)
+    bool coalesce;
+    // Idle window of lazy sampling (in seconds, 0 => the sampler runs all the time)
+    unsigned idle_window;
+    // Is the sampler pinned?
+    bool sampler_pinned;
+    // Placement of the sampler
+    struct cpu_affinity sampler_affinity;
+    // Maximum length of the request line (in bytes)
+    unsigned max_request_line;
+    // Maximum length of the header section of the request (in bytes)
+    unsigned max_headers;
+    // Directory the system information is read from (see set_proc_root())
+    const char *proc_root;
+    // Maximum number of open connections per worker (0 => no limit)
+    unsigned max_connections;
+    // Maximum number of connections waiting for CPU load per worker (0 => no limit)
+    unsigned max_waiting;
+    // Maximum queueing delay of workers in milliseconds (0 => delay isn't checked)
+    unsigned max_delay;
+    // Time the client has for closing the connection first (in milliseconds, 0 => the server closes it at once)
+    unsigned linger_timeout;
+    // Number of threads of the offload pool for blocking collectors (0 => workers call them)
+    unsigned offload_threads;
+};
+
+/**
+ * Loads the server configuration from CLI arguments
+ *
+ * @param argc Number of CLI arguments
+ * @param argv CLI arguments as array of "strings"
+ * @param config Pointer to the place where to save loaded configuration
+ * @return 0 => success, 1 => error (invalid arguments)
+ */
+int load_config(int argc, char *argv[], struct server_config *config);
+
+#endif //HINFOSVC_CONFIG_H
@@ -4,45 +4,65 @@
  *
  * @author Michal Šmahel (xsmahe01)
  */
+#define _GNU_SOURCE // cpu_set_t
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <signal.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <sys/signalfd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "http-processing.h"
+#include "config.h"
+#include "trace.h"
+#include "sampler.h"
+#include "history.h"
+#include "server.h"
+#include "affinity.h"
+#include "offload.h"
 
 /**
- * Maximum length of response message (header + body).
- * It is based on items' limits and the header skeleton
+ * Worker (event loop running in its own thread)
  */
-#define OUTPUT_BUFFER_LEN 512
+struct worker {
+    // Event loop of the worker
+    struct server server;
+    // Thread of the worker
+    pthread_t thread;
+    // Placement of the worker (NULL => the worker isn't pinned)
+    const struct cpu_affinity *affinity;
+    // Result of the event loop
+    int result;
+};
 
 /**
  * Creates and inits the welcome socket for TCP/IP communication
  *
- * @param port Port to bind socket to
+ * @param endpoint TCP endpoint to bind socket to
  * @return Welcome socket file descriptor or -1 if error occurred
- * @pre Valid port number (1025-65535)
+ * @pre Valid port number of the endpoint (1025-65535)
  */
-int make_welcome_socket(unsigned port) {
+int make_welcome_socket(const struct listen_endpoint *endpoint) {
     int welcome_socket;
-    struct sockaddr_in6 server_addr;
     int socket_flags;
+    int family = endpoint->address.ss_family;
 
     // Create a new socket
-    if ((welcome_socket = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+    if ((welcome_socket = socket(family, SOCK_STREAM, IPPROTO_TCP)) == -1) {
         fprintf(stderr, "Cannot create socket\n");
         return -1;
     }
 
-    // Apply configurations
+    // Apply configurations (IPv6 socket of a specific address doesn't block the same port of IPv4 addresses)
     // Source: https://stackoverflow.com/a/1618259
-    if (setsockopt(welcome_socket, IPPROTO_IPV6, IPV6_V6ONLY, &(int) {0}, sizeof(int)) == -1) {
+    if (family == AF_INET6
+        && setsockopt(welcome_socket, IPPROTO_IPV6, IPV6_V6ONLY, &(int) {!endpoint->dual_stack}, sizeof(int)) == -1) {
         fprintf(stderr, "Cannot setup socket\n");
         close(welcome_socket);
         return -1;
@@ -62,13 +82,75 @@ int make_welcome_socket(unsigned port) {
     socket_flags = fcntl(welcome_socket, F_GETFL, 0);
     fcntl(welcome_socket, F_SETFL, socket_flags | O_NONBLOCK);
 
-    // Assign an address and the port to the socket
-    server_addr.sin6_family = AF_INET6;
-    server_addr.sin6_addr = in6addr_any;
-    server_addr.sin6_port = htons(port);
+    // Assign the address and the port to the socket
+    if (bind(welcome_socket, (const struct sockaddr *) &endpoint->address, endpoint->address_length) == -1) {
+        fprintf(stderr, "Cannot bind socket to %s\n", endpoint->name);
+        close(welcome_socket);
+        return -1;
+    }
+
+    return welcome_socket;
+}
+
+/**
+ * Creates and inits the welcome socket for UNIX domain communication (local agents)
+ *
+ * Path starting with @ means a socket in the abstract namespace (Linux specific), it has no file
+ * in the filesystem. Otherwise, the stale socket file from the previous run is removed first.
+ *
+ * @param path Path of the socket (@ prefix => abstract namespace)
+ * @return Welcome socket file descriptor or -1 if error occurred
+ */
+int make_unix_socket(const char *path) {
+    int welcome_socket;
+    struct sockaddr_un server_addr;
+    socklen_t addr_length;
+    size_t path_length = strlen(path);
+
+    if (path_length == 0 || path_length >= sizeof(server_addr.sun_path)) {
+        fprintf(stderr, "Invalid path of UNIX socket: %s\n", path);
+        return -1;
+    }
+
+    if ((welcome_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        fprintf(stderr, "Cannot create UNIX socket\n");
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    memcpy(server_addr.sun_path, path, path_length);
+    addr_length = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + path_length);
+
+    if (path[0] == '@') {
+        // Abstract namespace is marked by the leading null byte (the name is not null terminated)
+        server_addr.sun_path[0] = '\0';
+    } else {
+        // Socket file could stay there after the previous run
+        unlink(path);
+        addr_length++;
+    }
+
+    if (bind(welcome_socket, (struct sockaddr *) &server_addr, addr_length) == -1) {
+        fprintf(stderr, "Cannot bind UNIX socket to %s\n", path);
+        close(welcome_socket);
+        return -1;
+    }
+
+    return welcome_socket;
+}
 
-    if (bind(welcome_socket, (struct sockaddr *) &server_addr, sizeof(server_addr)) == -1) {
-        fprintf(stderr, "Cannot bind socket to port %d\n", port);
+/**
+ * Creates the welcome socket of the endpoint and starts listening on it
+ *
+ * @param endpoint Endpoint to listen on
+ * @return Welcome socket file descriptor or -1 if error occurred
+ */
+int make_listening_socket(const struct listen_endpoint *endpoint) {
+    int welcome_socket = endpoint->type == UNIX_E ? make_unix_socket(endpoint->path) : make_welcome_socket(endpoint);
+
+    if (welcome_socket != -1 && listen(welcome_socket, SOMAXCONN) == -1) {
+        fprintf(stderr, "Cannot start socket listening on %s\n", endpoint->name);
         close(welcome_socket);
         return -1;
     }
@@ -76,6 +158,133 @@ int make_welcome_socket(unsigned port) {
     return welcome_socket;
 }
 
+/**
+ * Closes welcome sockets and removes socket files of UNIX sockets
+ *
+ * @param config Configuration with listen endpoints
+ * @param sockets Welcome sockets of the endpoints
+ * @param count Number of created welcome sockets
+ */
+void close_welcome_sockets(const struct server_config *config, const int *sockets, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        close(sockets[i]);
+
+        // Sockets in the abstract namespace have no file
+        if (config->endpoints[i].type == UNIX_E && config->endpoints[i].path[0] != '@') {
+            unlink(config->endpoints[i].path);
+        }
+    }
+}
+
+/**
+ * Inits event loops of workers, all of them serve all welcome sockets
+ *
+ * @param workers Workers to init
+ * @param config Configuration of the server
+ * @param int_signal SIGINT file descriptor
+ * @param sockets Welcome sockets of the endpoints
+ * @param limiter Per-client rate limiter (shared by all workers)
+ * @return Number of initialized workers (config->workers => success)
+ */
+unsigned init_workers(struct worker *workers, const struct server_config *config, int int_signal, const int *sockets,
+                      struct rate_limiter *limiter) {
+    struct listener_stats *stats[MAX_LISTENERS];
+
+    for (unsigned i = 0; i < config->endpoints_count; i++) {
+        if ((stats[i] = listener_stats_register(config->endpoints[i].name)) == NULL) {
+            fprintf(stderr, "Cannot register statistics of endpoint %s\n", config->endpoints[i].name);
+            return 0;
+        }
+    }
+
+    for (unsigned w = 0; w < config->workers; w++) {
+        if (server_init(&workers[w].server, config, int_signal, limiter) != 0) {
+            return w;
+        }
+
+        for (unsigned i = 0; i < config->endpoints_count; i++) {
+            if (server_add_listener(&workers[w].server, sockets[i], stats[i]) != 0) {
+                server_destroy(&workers[w].server);
+                return w;
+            }
+        }
+
+        // Workers take placements in turn
+        workers[w].affinity = config->worker_affinities_count > 0
+                              ? &config->worker_affinities[w % config->worker_affinities_count] : NULL;
+    }
+
+    return config->workers;
+}
+
+/**
+ * Releases event loops of workers
+ *
+ * @param workers Workers to release
+ * @param count Number of initialized workers
+ */
+void destroy_workers(struct worker *workers, unsigned count) {
+    for (unsigned w = 0; w < count; w++) {
+        server_destroy(&workers[w].server);
+    }
+    free(workers);
+}
+
+/**
+ * Main function of the worker thread
+ *
+ * @param arg Worker to run
+ * @return Always NULL
+ */
+void *worker_run(void *arg) {
+    struct worker *worker = arg;
+
+    // Connections are allocated by the worker, so they come from the memory of its NUMA node
+    affinity_bind_memory(worker->affinity);
+    init_thread_caches(&worker->server.completions);
+
+    worker->result = server_run(&worker->server);
+
+    // Jobs of the offload pool refer to caches of this thread, so they must finish before the thread ends
+    offload_wait(&worker->server.completions);
+    return NULL;
+}
+
+/**
+ * Runs workers in their threads and waits until all of them stop (after SIGINT)
+ *
+ * @param workers Workers to run
+ * @param count Number of workers
+ * @return 0 => success, 1 => error
+ */
+int run_workers(struct worker *workers, unsigned count) {
+    pthread_attr_t thread_attr;
+    unsigned started;
+    int result = 0;
+
+    for (started = 0; started < count; started++) {
+        pthread_attr_init(&thread_attr);
+        if (affinity_set_attr(&thread_attr, workers[started].affinity) != 0
+            || pthread_create(&workers[started].thread, &thread_attr, worker_run, &workers[started]) != 0) {
+            fprintf(stderr, "Cannot start worker %u\n", started);
+            pthread_attr_destroy(&thread_attr);
+
+            // Running workers are stopped the same way as by the user (pending SIGINT wakes up all of them)
+            kill(getpid(), SIGINT);
+            result = 1;
+            break;
+        }
+        pthread_attr_destroy(&thread_attr);
+    }
+
+    for (unsigned w = 0; w < started; w++) {
+        pthread_join(workers[w].thread, NULL);
+        result |= workers[w].result;
+    }
+
+    return result;
+}
+
 /**
  * Makes and inits SIGINT file descriptor
  *
@@ -107,101 +316,108 @@ int make_int_sig_fd() {
  * Inspired by the 2nd presentation from the subject IPK on FIT BUT
  */
 int main(int argc, char *argv[]) {
-    bool keep_running = true;
-    unsigned port;
-
+    struct server_config config;
+    struct worker *workers;
+    unsigned workers_count;
+    struct rate_limiter limiter;
+    int notify_fds[MAX_WORKERS];
     int int_signal;
-    int conn_socket;
-    int welcome_socket;
-    fd_set read_socks, write_socks;
-
-    struct sockaddr_in6 client_addr;
-    unsigned client_addr_len = sizeof(client_addr);
-    char response_buffer[OUTPUT_BUFFER_LEN + 1] = "";
+    int sockets[MAX_LISTENERS];
+    unsigned sockets_count;
+    int result;
 
-    // Load port from CLI (required argument)
-    if (argc < 2) {
-        fprintf(stderr, "You need to specify a port. For example: %s 12345\n", argv[0]);
+    // Load configuration from CLI (at least one endpoint is required)
+    if (load_config(argc, argv, &config) != 0) {
         return 1;
     }
 
-    port = strtoul(argv[1], NULL, 10);
-    if (port < 1025 || port > 65535) {
-        fprintf(stderr, "Port must be a number 1025-65535 (0-1024 are protected by OS)\n");
+    if (config.trace) {
+        trace_enable();
+    }
+    set_load_sample_interval(config.load_interval);
+    set_http_limits(config.max_request_line, config.max_headers);
+    set_proc_root(config.proc_root);
+    if (init_routes() != 0) {
         return 1;
     }
 
     // Setup handling SIGINT for smooth stop of the program
+    // (it must be done before starting any thread, so threads inherit the signal mask)
     if ((int_signal = make_int_sig_fd()) == -1) {
         fprintf(stderr, "Cannot create SIGINT file descriptor\n");
         return 1;
     }
 
-    // Setup socket
-    if ((welcome_socket = make_welcome_socket(port)) == -1) {
-        return 1;
+    // Setup sockets
+    for (sockets_count = 0; sockets_count < config.endpoints_count; sockets_count++) {
+        if ((sockets[sockets_count] = make_listening_socket(&config.endpoints[sockets_count])) == -1) {
+            close_welcome_sockets(&config, sockets, sockets_count);
+            return 1;
+        }
     }
 
-    // Start listening
-    if (listen(welcome_socket, 1) == -1) {
-        fprintf(stderr, "Cannot start socket listening\n");
-        close(welcome_socket);
+    // Any worker can accept the next connection of a client, so all of them take tokens from the same buckets
+    if (rate_limiter_init(&limiter, config.rate_limit, config.rate_burst) != 0) {
+        close_welcome_sockets(&config, sockets, sockets_count);
         return 1;
     }
 
-    while (keep_running) {
-        // Prepare file descriptor watchers
-        FD_ZERO(&read_socks);
-        FD_ZERO(&write_socks);
-
-        FD_SET(welcome_socket, &read_socks);
-        FD_SET(int_signal, &read_socks);
-        FD_SET(welcome_socket, &write_socks);
-
-        // Passive wait for new connection or SIGINT
-        select(FD_SETSIZE, &read_socks, &write_socks, NULL, NULL);
+    if ((workers = calloc(config.workers, sizeof(*workers))) == NULL) {
+        fprintf(stderr, "Cannot allocate memory for workers\n");
+        rate_limiter_free(&limiter);
+        close_welcome_sockets(&config, sockets, sockets_count);
+        return 1;
+    }
 
-        // Handling SIGINT --> stop the server
-        if (FD_ISSET(int_signal, &read_socks)) {
-            close(welcome_socket);
-            keep_running = false;
-            continue;
-        }
+    // Each worker has its own event loop, all of them serve all sockets (with the same handlers)
+    if ((workers_count = init_workers(workers, &config, int_signal, sockets, &limiter)) != config.workers) {
+        destroy_workers(workers, workers_count);
+        rate_limiter_free(&limiter);
+        close_welcome_sockets(&config, sockets, sockets_count);
+        return 1;
+    }
 
-        if (!FD_ISSET(welcome_socket, &write_socks) && !FD_ISSET(welcome_socket, &read_socks)) {
-            continue;
-        }
+    // Samples of the sampler are kept in the history (it is empty if the file is new)
+    if (history_open(config.history_path) != 0) {
+        destroy_workers(workers, workers_count);
+        rate_limiter_free(&limiter);
+        close_welcome_sockets(&config, sockets, sockets_count);
+        return 1;
+    }
 
-        // Create connection for data transfer throw new socket
-        conn_socket = accept(welcome_socket, (struct sockaddr *) &client_addr, &client_addr_len);
-        if (conn_socket == -1) {
-            fprintf(stderr, "Cannot create connection socket for data transfer\n");
-            close(welcome_socket);
-            return 1;
-        }
+    // CPU load is measured in the background (or by event loops when coalescing), requests just read the sample
+    for (unsigned w = 0; w < workers_count; w++) {
+        notify_fds[w] = workers[w].server.sampler.fd;
+    }
+    if (config.coalesce ? sampler_start_coalescing(config.load_interval, notify_fds, workers_count) != 0
+                        : sampler_start(config.load_interval, config.idle_window, notify_fds, workers_count,
+                                        config.sampler_pinned ? &config.sampler_affinity : NULL) != 0) {
+        history_close();
+        destroy_workers(workers, workers_count);
+        rate_limiter_free(&limiter);
+        close_welcome_sockets(&config, sockets, sockets_count);
+        return 1;
+    }
 
-        // Process HTTP request
-        if (process_http_request(conn_socket, response_buffer) != 0) {
-            fprintf(stderr, "Cannot process HTTP request\n");
-            close(conn_socket);
-            close(welcome_socket);
-            return 1;
-        }
+    // Blocking collectors of workers are called by the offload pool
+    if (offload_start(config.offload_threads) != 0) {
+        sampler_stop();
+        history_close();
+        destroy_workers(workers, workers_count);
+        rate_limiter_free(&limiter);
+        close_welcome_sockets(&config, sockets, sockets_count);
+        return 1;
+    }
 
-        // Send HTTP response
-        if (write(conn_socket, response_buffer, strlen(response_buffer)) == -1) {
-            fprintf(stderr, "Cannot write data to connection socket\n");
-            close(conn_socket);
-            close(welcome_socket);
-            return 1;
-        }
+    result = run_workers(workers, workers_count);
 
-        if (close(conn_socket) == -1) {
-            fprintf(stderr, "Cannot close connection socket\n");
-            close(welcome_socket);
-            return 1;
-        }
-    }
+    offload_stop();
+    sampler_stop();
+    history_close();
+    destroy_workers(workers, workers_count);
+    rate_limiter_free(&limiter);
+    close_welcome_sockets(&config, sockets, sockets_count);
+    close(int_signal);
 
-    return 0;
+    return result;
 }
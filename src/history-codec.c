@@ -0,0 +1,314 @@
+/**
+ * @file history-codec.c
+ * Compression of CPU load history blocks
+ *
+ * Records are compressed like in Facebook's Gorilla (http://www.vldb.org/pvldb/vol8/p1816-teller.pdf).
+ * Samples are taken periodically, so a timestamp is stored as the difference of its delta from
+ * the previous delta (mostly a few bits). Consecutive values share most of their bits, so a value is
+ * stored as meaningful bits of its XOR with the previous value.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <string.h>
+#include "history-codec.h"
+
+/**
+ * Maximum number of bits of one compressed record (timestamp and values with new XOR windows)
+ */
+#define MAX_RECORD_BITS (4 + 64 + HISTORY_VALUES * (2 + 6 + 6 + 64))
+
+/**
+ * Writes bits to the bit stream (the most significant bit first)
+ *
+ * @param data Bit stream (unused bits must be zeros)
+ * @param position Position of the first bit to write (it is moved behind the written bits)
+ * @param value Bits to write (in the lowest bits)
+ * @param count Number of bits to write (at most 64)
+ */
+void put_bits(uint8_t *data, uint32_t *position, uint64_t value, unsigned count) {
+    unsigned free_bits;
+    unsigned taken;
+
+    while (count > 0) {
+        free_bits = 8 - (*position & 7);
+        taken = count < free_bits ? count : free_bits;
+        data[*position >> 3] |= (uint8_t) (((value >> (count - taken)) & ((1u << taken) - 1)) << (free_bits - taken));
+        *position += taken;
+        count -= taken;
+    }
+}
+
+/**
+ * Reads bits from the bit stream (the most significant bit first)
+ *
+ * @param data Bit stream
+ * @param position Position of the first bit to read (it is moved behind the read bits)
+ * @param count Number of bits to read (at most 64)
+ * @return Read bits (in the lowest bits)
+ */
+uint64_t get_bits(const uint8_t *data, uint32_t *position, unsigned count) {
+    uint64_t value = 0;
+    unsigned available;
+    unsigned taken;
+
+    while (count > 0) {
+        available = 8 - (*position & 7);
+        taken = count < available ? count : available;
+        value = (value << taken) | ((data[*position >> 3] >> (available - taken)) & ((1u << taken) - 1));
+        *position += taken;
+        count -= taken;
+    }
+
+    return value;
+}
+
+/**
+ * Converts the record to the array of compressed values
+ *
+ * @param record Record to convert
+ * @param values Pointer to the place where to save the values
+ */
+void record_to_values(const struct history_record *record, uint64_t *values) {
+    values[0] = (uint32_t) record->load;
+    memcpy(&values[1], record->stats, sizeof(record->stats));
+}
+
+/**
+ * Empties the block
+ *
+ * @param block Block to empty
+ */
+void history_block_reset(struct history_block *block) {
+    memset(block, 0, sizeof(*block));
+}
+
+/**
+ * Drops bits of the block behind the position (bits of a record whose appending has been interrupted)
+ *
+ * @param block Block to truncate
+ * @param position Position of the first bit to drop (the end of the last counted record)
+ */
+void history_block_truncate(struct history_block *block, uint32_t position) {
+    uint32_t byte = position >> 3;
+
+    // Bits are ORed by put_bits(), so the dropped ones must be zeros again
+    if ((position & 7) != 0) {
+        block->data[byte] &= (uint8_t) (0xff << (8 - (position & 7)));
+        byte++;
+    }
+    memset(&block->data[byte], 0, sizeof(block->data) - byte);
+    block->bit_length = position;
+}
+
+/**
+ * Inits the state of the encoder (for an empty block) or the decoder (for reading from the start)
+ *
+ * @param codec State to init
+ */
+void history_codec_init(struct history_codec *codec) {
+    memset(codec, 0, sizeof(*codec));
+    memset(codec->leading, 64, sizeof(codec->leading));
+}
+
+/**
+ * Writes the timestamp as the difference of its delta from the previous delta
+ *
+ * @param block Block to write to
+ * @param encoder State of the encoder
+ * @param timestamp Timestamp to write
+ */
+void encode_timestamp(struct history_block *block, struct history_codec *encoder, uint64_t timestamp) {
+    int64_t delta = (int64_t) (timestamp - encoder->timestamp);
+    int64_t delta_of_delta = delta - encoder->delta;
+
+    // Ranges of the Gorilla paper, just the largest one has 64 bits (samples may be missing for days)
+    if (delta_of_delta == 0) {
+        put_bits(block->data, &block->bit_length, 0x0, 1);
+    } else if (delta_of_delta >= -63 && delta_of_delta <= 64) {
+        put_bits(block->data, &block->bit_length, 0x2, 2);
+        put_bits(block->data, &block->bit_length, (uint64_t) (delta_of_delta + 63), 7);
+    } else if (delta_of_delta >= -255 && delta_of_delta <= 256) {
+        put_bits(block->data, &block->bit_length, 0x6, 3);
+        put_bits(block->data, &block->bit_length, (uint64_t) (delta_of_delta + 255), 9);
+    } else if (delta_of_delta >= -2047 && delta_of_delta <= 2048) {
+        put_bits(block->data, &block->bit_length, 0xe, 4);
+        put_bits(block->data, &block->bit_length, (uint64_t) (delta_of_delta + 2047), 12);
+    } else {
+        put_bits(block->data, &block->bit_length, 0xf, 4);
+        put_bits(block->data, &block->bit_length, (uint64_t) delta_of_delta, 64);
+    }
+
+    encoder->timestamp = timestamp;
+    encoder->delta = delta;
+}
+
+/**
+ * Reads the timestamp written by encode_timestamp()
+ *
+ * @param block Block to read from
+ * @param decoder State of the decoder
+ * @return Decoded timestamp
+ */
+uint64_t decode_timestamp(const struct history_block *block, struct history_codec *decoder) {
+    int64_t delta_of_delta;
+
+    if (get_bits(block->data, &decoder->position, 1) == 0) {
+        delta_of_delta = 0;
+    } else if (get_bits(block->data, &decoder->position, 1) == 0) {
+        delta_of_delta = (int64_t) get_bits(block->data, &decoder->position, 7) - 63;
+    } else if (get_bits(block->data, &decoder->position, 1) == 0) {
+        delta_of_delta = (int64_t) get_bits(block->data, &decoder->position, 9) - 255;
+    } else if (get_bits(block->data, &decoder->position, 1) == 0) {
+        delta_of_delta = (int64_t) get_bits(block->data, &decoder->position, 12) - 2047;
+    } else {
+        delta_of_delta = (int64_t) get_bits(block->data, &decoder->position, 64);
+    }
+
+    decoder->delta += delta_of_delta;
+    decoder->timestamp += (uint64_t) decoder->delta;
+
+    return decoder->timestamp;
+}
+
+/**
+ * Writes the value as meaningful bits of its XOR with the previous value
+ *
+ * @param block Block to write to
+ * @param encoder State of the encoder
+ * @param i Index of the value
+ * @param value Value to write
+ */
+void encode_value(struct history_block *block, struct history_codec *encoder, int i, uint64_t value) {
+    uint64_t xor = value ^ encoder->values[i];
+    unsigned leading;
+    unsigned trailing;
+
+    encoder->values[i] = value;
+
+    if (xor == 0) {
+        put_bits(block->data, &block->bit_length, 0x0, 1);
+        return;
+    }
+
+    leading = (unsigned) __builtin_clzll(xor);
+    trailing = (unsigned) __builtin_ctzll(xor);
+
+    if (encoder->leading[i] < 64 && leading >= encoder->leading[i] && trailing >= encoder->trailing[i]) {
+        // Meaningful bits fit into the previous window
+        put_bits(block->data, &block->bit_length, 0x2, 2);
+        put_bits(block->data, &block->bit_length, xor >> encoder->trailing[i],
+                 64 - encoder->leading[i] - encoder->trailing[i]);
+    } else {
+        // New window (the length is stored minus one, so 64 fits into 6 bits)
+        put_bits(block->data, &block->bit_length, 0x3, 2);
+        put_bits(block->data, &block->bit_length, leading, 6);
+        put_bits(block->data, &block->bit_length, 64 - leading - trailing - 1, 6);
+        put_bits(block->data, &block->bit_length, xor >> trailing, 64 - leading - trailing);
+
+        encoder->leading[i] = (uint8_t) leading;
+        encoder->trailing[i] = (uint8_t) trailing;
+    }
+}
+
+/**
+ * Reads the value written by encode_value()
+ *
+ * @param block Block to read from
+ * @param decoder State of the decoder
+ * @param i Index of the value
+ * @return Decoded value
+ */
+uint64_t decode_value(const struct history_block *block, struct history_codec *decoder, int i) {
+    unsigned length;
+
+    if (get_bits(block->data, &decoder->position, 1) == 0) {
+        return decoder->values[i];
+    }
+
+    if (get_bits(block->data, &decoder->position, 1) == 1) {
+        decoder->leading[i] = (uint8_t) get_bits(block->data, &decoder->position, 6);
+        length = (unsigned) get_bits(block->data, &decoder->position, 6) + 1;
+        decoder->trailing[i] = (uint8_t) (64 - decoder->leading[i] - length);
+    }
+
+    length = 64 - decoder->leading[i] - decoder->trailing[i];
+    decoder->values[i] ^= get_bits(block->data, &decoder->position, length) << decoder->trailing[i];
+
+    return decoder->values[i];
+}
+
+/**
+ * Appends the record to the end of the block
+ *
+ * @param block Block to append to
+ * @param encoder State of the encoder after all records of the block
+ * @param record Record to append (its timestamp must not be lower than the previous one)
+ * @return Has been the record appended? (false => the block is full)
+ */
+bool history_block_append(struct history_block *block, struct history_codec *encoder,
+                          const struct history_record *record) {
+    uint64_t values[HISTORY_VALUES];
+
+    if (block->bit_length + MAX_RECORD_BITS > sizeof(block->data) * 8) {
+        return false;
+    }
+
+    record_to_values(record, values);
+
+    if (block->count == 0) {
+        // The first record is stored as it is, the following ones are relative to it
+        block->first_timestamp = record->timestamp;
+        encoder->timestamp = record->timestamp;
+        for (int i = 0; i < HISTORY_VALUES; i++) {
+            put_bits(block->data, &block->bit_length, values[i], 64);
+            encoder->values[i] = values[i];
+        }
+    } else {
+        encode_timestamp(block, encoder, record->timestamp);
+        for (int i = 0; i < HISTORY_VALUES; i++) {
+            encode_value(block, encoder, i, values[i]);
+        }
+    }
+
+    // The count is raised after the bits are complete, so a crash leaves just unused bits behind the counted
+    // records (history_block_truncate() drops them)
+    block->count++;
+    encoder->position = block->bit_length;
+    encoder->index = block->count;
+
+    return true;
+}
+
+/**
+ * Decodes the next record of the block (streaming, no record is decoded twice)
+ *
+ * @param block Block to decode
+ * @param decoder State of the decoder after the previous record
+ * @param record Pointer to the place where to save the decoded record
+ * @return Has been any record decoded? (false => the end of the block)
+ */
+bool history_block_next(const struct history_block *block, struct history_codec *decoder,
+                        struct history_record *record) {
+    if (decoder->index >= block->count) {
+        return false;
+    }
+
+    if (decoder->index == 0) {
+        decoder->timestamp = block->first_timestamp;
+        for (int i = 0; i < HISTORY_VALUES; i++) {
+            decoder->values[i] = get_bits(block->data, &decoder->position, 64);
+        }
+    } else {
+        decode_timestamp(block, decoder);
+        for (int i = 0; i < HISTORY_VALUES; i++) {
+            decode_value(block, decoder, i);
+        }
+    }
+    decoder->index++;
+
+    record->timestamp = decoder->timestamp;
+    record->load = (int32_t) (uint32_t) decoder->values[0];
+    memcpy(record->stats, &decoder->values[1], sizeof(record->stats));
+
+    return true;
+}
@@ -0,0 +1,111 @@
+#ifndef HINFOSVC_HISTORY_CODEC_H
+#define HINFOSVC_HISTORY_CODEC_H
+/**
+ * @file history-codec.h
+ * Header of compression of CPU load history blocks
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Size of one compressed block of the history (in bytes)
+ */
+#define HISTORY_BLOCK_SIZE 4096
+/**
+ * Number of compressed values of one record (CPU load and 8 CPU statistics counters)
+ */
+#define HISTORY_VALUES 9
+
+/**
+ * Sample of the history (decoded record)
+ */
+struct history_record {
+    // Time when the sample was taken (Unix time in milliseconds)
+    uint64_t timestamp;
+    // CPU load in %
+    int32_t load;
+    // CPU statistics the sample was computed from (user, nice, system, idle, iowait, irq, softirq, steal)
+    uint64_t stats[8];
+};
+
+/**
+ * Block of compressed records (its records are ordered by timestamps)
+ */
+struct history_block {
+    // Timestamp of the first record (Unix time in milliseconds)
+    uint64_t first_timestamp;
+    // Number of records in the block
+    uint32_t count;
+    // Number of used bits of the data
+    uint32_t bit_length;
+    // Bit stream of compressed records
+    uint8_t data[HISTORY_BLOCK_SIZE - 16];
+};
+
+/**
+ * State of the encoder or the decoder of the block (they must be in the same state after each record)
+ */
+struct history_codec {
+    // Timestamp of the previous record
+    uint64_t timestamp;
+    // Difference between timestamps of the previous two records
+    int64_t delta;
+    // Values of the previous record
+    uint64_t values[HISTORY_VALUES];
+    // Leading zeros of the current window of meaningful XOR bits (64 => no window yet)
+    uint8_t leading[HISTORY_VALUES];
+    // Trailing zeros of the current window of meaningful XOR bits
+    uint8_t trailing[HISTORY_VALUES];
+    // Position in the bit stream (the next bit to read)
+    uint32_t position;
+    // Number of already processed records
+    uint32_t index;
+};
+
+/**
+ * Empties the block
+ *
+ * @param block Block to empty
+ */
+void history_block_reset(struct history_block *block);
+
+/**
+ * Drops bits of the block behind the position (bits of a record whose appending has been interrupted)
+ *
+ * @param block Block to truncate
+ * @param position Position of the first bit to drop (the end of the last counted record)
+ */
+void history_block_truncate(struct history_block *block, uint32_t position);
+
+/**
+ * Inits the state of the encoder (for an empty block) or the decoder (for reading from the start)
+ *
+ * @param codec State to init
+ */
+void history_codec_init(struct history_codec *codec);
+
+/**
+ * Appends the record to the end of the block
+ *
+ * @param block Block to append to
+ * @param encoder State of the encoder after all records of the block
+ * @param record Record to append (its timestamp must not be lower than the previous one)
+ * @return Has been the record appended? (false => the block is full)
+ */
+bool history_block_append(struct history_block *block, struct history_codec *encoder,
+                          const struct history_record *record);
+
+/**
+ * Decodes the next record of the block (streaming, no record is decoded twice)
+ *
+ * @param block Block to decode
+ * @param decoder State of the decoder after the previous record
+ * @param record Pointer to the place where to save the decoded record
+ * @return Has been any record decoded? (false => the end of the block)
+ */
+bool history_block_next(const struct history_block *block, struct history_codec *decoder,
+                        struct history_record *record);
+
+#endif //HINFOSVC_HISTORY_CODEC_H
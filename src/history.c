@@ -0,0 +1,665 @@
+/**
+ * @file history.c
+ * Persistent history of CPU load samples
+ *
+ * Samples are stored in a fixed-size ring of compressed blocks (see history-codec.c). The ring is
+ * a memory mapped file, so the history survives restarts of the server and writing a sample is just
+ * a few memory stores. Timestamps of the records grow, so the first block of a time range is found
+ * by binary search over the ring and records are decoded from there as a stream.
+ *
+ * Each sample also updates rollups (minimum, maximum, sum and count of CPU load) of its minute and hour.
+ * Rollups are kept in fixed-size rings indexed by the time, so the update is O(1) and queries over long
+ * ranges read a few hundred aggregated slots instead of all samples. The raw ring serves as the finest
+ * (1 second) resolution.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "aggregation.h"
+
+/**
+ * Magic bytes at the beginning of the history file
+ */
+#define HISTORY_MAGIC "HINFOHST"
+/**
+ * Version of the history file format
+ */
+#define HISTORY_VERSION 3
+/**
+ * Number of slots of the minute rollups (31 days)
+ */
+#define MINUTE_ROLLUPS_CAPACITY (31 * 24 * 60)
+/**
+ * Number of slots of the hour rollups (366 days)
+ */
+#define HOUR_ROLLUPS_CAPACITY (366 * 24)
+
+/**
+ * Header of the history file (blocks follow it)
+ */
+struct history_header {
+    // HISTORY_MAGIC (without the terminating null byte)
+    char magic[8];
+    // HISTORY_VERSION
+    uint32_t version;
+    // Size of one block (sizeof(struct history_block))
+    uint32_t block_size;
+    // Number of blocks in the ring
+    uint64_t capacity;
+    // Number of all blocks ever started (records are appended to the block (head - 1) % capacity)
+    uint64_t head;
+    // Padding to the size of a cache line
+    uint8_t reserved[32];
+};
+
+/**
+ * Aggregated CPU load over one period of the rollup tier
+ */
+struct history_rollup {
+    // Start of the period (Unix time in seconds)
+    uint64_t start;
+    // Sum of CPU load values
+    int64_t sum;
+    // Minimum CPU load
+    int32_t min;
+    // Maximum CPU load
+    int32_t max;
+    // Number of samples (0 => empty slot)
+    uint32_t count;
+    // Padding (keeps the slot size the same on all architectures)
+    uint32_t reserved;
+};
+
+/**
+ * Mapped history file
+ */
+struct history_file {
+    struct history_header header;
+    struct history_block blocks[HISTORY_BLOCKS];
+    struct history_rollup minute_rollups[MINUTE_ROLLUPS_CAPACITY];
+    struct history_rollup hour_rollups[HOUR_ROLLUPS_CAPACITY];
+};
+
+/**
+ * Ring of rollups with the same resolution
+ */
+struct history_tier {
+    // Length of one period (in seconds)
+    uint64_t resolution;
+    // Number of slots
+    uint64_t capacity;
+    // Slots of the ring (slot of the period is (start / resolution) % capacity)
+    struct history_rollup *rollups;
+};
+
+/**
+ * Aggregation of one point (step) of the query result
+ */
+struct history_point {
+    // Index of the step from the start of the range
+    uint64_t index;
+    // Sum of CPU load values
+    int64_t sum;
+    // Minimum CPU load
+    int min;
+    // Maximum CPU load
+    int max;
+    // Number of samples (0 => no data in the step yet)
+    uint64_t count;
+};
+
+/**
+ * Identifiers of rollup tiers (from the finest one)
+ */
+enum history_tier_id {
+    MINUTE_T,
+    HOUR_T,
+    // Number of tiers (not a tier)
+    TIERS_COUNT,
+};
+
+/**
+ * Mapped history (NULL => history is not opened)
+ */
+static struct history_file *history = NULL;
+/**
+ * File descriptor of the history file (-1 => history is kept in memory only)
+ */
+static int history_fd = -1;
+/**
+ * Lock of the history (the sampler appends, the event loop queries)
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Rollup tiers (they point to the mapped history)
+ */
+static struct history_tier tiers[TIERS_COUNT];
+/**
+ * State of the encoder of the current block (the timestamp is the latest one in the history)
+ */
+static struct history_codec writer;
+
+/**
+ * Returns the number of blocks in the ring
+ *
+ * @return Number of blocks
+ */
+uint64_t history_blocks_count(void) {
+    return history->header.head < HISTORY_BLOCKS ? history->header.head : HISTORY_BLOCKS;
+}
+
+/**
+ * Returns the block by its logical index (0 => the oldest block in the ring)
+ *
+ * @param index Logical index of the block
+ * @return The block
+ */
+struct history_block *history_block_at(uint64_t index) {
+    return &history->blocks[(history->header.head - history_blocks_count() + index) % HISTORY_BLOCKS];
+}
+
+/**
+ * Returns the block the records are appended to
+ *
+ * @return The current block
+ * @pre The history isn't empty
+ */
+struct history_block *history_current_block(void) {
+    return &history->blocks[(history->header.head - 1) % HISTORY_BLOCKS];
+}
+
+/**
+ * Checks whether the mapped history has the expected format
+ *
+ * @param header Header of the mapped history
+ * @return Can be records of the history used?
+ */
+bool history_is_valid(const struct history_header *header) {
+    return memcmp(header->magic, HISTORY_MAGIC, sizeof(header->magic)) == 0 && header->version == HISTORY_VERSION
+           && header->block_size == sizeof(struct history_block) && header->capacity == HISTORY_BLOCKS;
+}
+
+/**
+ * Opens (or creates) the history ring
+ *
+ * Records from the previous run are kept if the file has the expected format. Otherwise, the file
+ * is reinitialized.
+ *
+ * @param path Path of the history file (NULL => history is kept in memory only)
+ * @return 0 => success, 1 => error
+ */
+int history_open(const char *path) {
+    struct stat file_stat;
+    void *mapping;
+
+    if (path == NULL) {
+        mapping = mmap(NULL, sizeof(*history), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        if ((history_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+            fprintf(stderr, "Cannot open history file %s\n", path);
+            return 1;
+        }
+
+        // File of another size surely has another format, so it is resized and reinitialized
+        if (fstat(history_fd, &file_stat) == -1
+            || ((size_t) file_stat.st_size != sizeof(*history) && ftruncate(history_fd, 0) == -1)
+            || ftruncate(history_fd, sizeof(*history)) == -1) {
+            fprintf(stderr, "Cannot resize history file %s\n", path);
+            close(history_fd);
+            history_fd = -1;
+            return 1;
+        }
+
+        mapping = mmap(NULL, sizeof(*history), PROT_READ | PROT_WRITE, MAP_SHARED, history_fd, 0);
+    }
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Cannot map history\n");
+        if (history_fd != -1) {
+            close(history_fd);
+            history_fd = -1;
+        }
+        return 1;
+    }
+
+    history = mapping;
+    if (!history_is_valid(&history->header)) {
+        memset(&history->header, 0, sizeof(history->header));
+        memcpy(history->header.magic, HISTORY_MAGIC, sizeof(history->header.magic));
+        history->header.version = HISTORY_VERSION;
+        history->header.block_size = sizeof(struct history_block);
+        history->header.capacity = HISTORY_BLOCKS;
+        memset(history->minute_rollups, 0, sizeof(history->minute_rollups));
+        memset(history->hour_rollups, 0, sizeof(history->hour_rollups));
+    }
+
+    tiers[MINUTE_T] = (struct history_tier) {60, MINUTE_ROLLUPS_CAPACITY, history->minute_rollups};
+    tiers[HOUR_T] = (struct history_tier) {3600, HOUR_ROLLUPS_CAPACITY, history->hour_rollups};
+
+    // The encoder continues where it stopped in the previous run, so its state is restored by decoding
+    history_codec_init(&writer);
+    if (history->header.head > 0) {
+        while (history_block_next(history_current_block(), &writer, &(struct history_record) {0}));
+        // Crash during appending leaves bits of an uncounted record, the next record must not follow them
+        history_block_truncate(history_current_block(), writer.position);
+    }
+
+    return 0;
+}
+
+/**
+ * Unmaps the history ring (and closes its file)
+ */
+void history_close(void) {
+    if (history == NULL) {
+        return;
+    }
+
+    munmap(history, sizeof(*history));
+    history = NULL;
+
+    if (history_fd != -1) {
+        close(history_fd);
+        history_fd = -1;
+    }
+}
+
+
+/**
+ * Adds CPU load to the rollup of its period (O(1), the slot of an old period is reused)
+ *
+ * @param tier Rollup tier to update
+ * @param time Time of the sample (Unix time in seconds)
+ * @param load CPU load in %
+ * @pre The lock is held by the caller
+ */
+void history_tier_update(struct history_tier *tier, uint64_t time, int load) {
+    uint64_t start = time / tier->resolution * tier->resolution;
+    struct history_rollup *rollup = &tier->rollups[time / tier->resolution % tier->capacity];
+
+    if (rollup->count == 0 || rollup->start != start) {
+        *rollup = (struct history_rollup) {start, 0, load, load, 0, 0};
+    }
+
+    rollup->sum += load;
+    rollup->min = load < rollup->min ? load : rollup->min;
+    rollup->max = load > rollup->max ? load : rollup->max;
+    rollup->count++;
+}
+
+/**
+ * Appends a sample to the history ring (the oldest record is overwritten when the ring is full)
+ *
+ * @param timestamp Time when the sample was taken (Unix time in milliseconds)
+ * @param load CPU load in %
+ * @param stats CPU statistics the sample was computed from
+ */
+void history_append(uint64_t timestamp, int load, const struct proc_stats *stats) {
+    struct history_record record;
+
+    if (history == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    // Binary search needs growing timestamps, so steps of the wall clock back are flattened
+    if (history->header.head > 0 && timestamp <= writer.timestamp) {
+        timestamp = writer.timestamp + 1;
+    }
+
+    record = (struct history_record) {timestamp, load, {stats->user, stats->nice, stats->system, stats->idle,
+                                                        stats->iowait, stats->irq, stats->softirq, stats->steal}};
+
+    if (history->header.head == 0 || !history_block_append(history_current_block(), &writer, &record)) {
+        // The oldest block is emptied before it becomes the current one
+        history_block_reset(&history->blocks[history->header.head % HISTORY_BLOCKS]);
+        history->header.head++;
+        history_codec_init(&writer);
+        history_block_append(history_current_block(), &writer, &record);
+    }
+
+    for (int i = 0; i < TIERS_COUNT; i++) {
+        history_tier_update(&tiers[i], timestamp / 1000, load);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Finds the block where records not older than the timestamp start (binary search)
+ *
+ * @param timestamp Searched timestamp (Unix time in milliseconds)
+ * @return Logical index of the last block starting before the timestamp (0 if there is no such block)
+ * @pre The lock is held by the caller
+ */
+uint64_t history_find_block(uint64_t timestamp) {
+    uint64_t low = 0;
+    uint64_t high = history_blocks_count();
+    uint64_t middle;
+
+    // Finds the first block starting at the timestamp or later
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (history_block_at(middle)->first_timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // Records of the previous block could be in the range too
+    return low > 0 ? low - 1 : 0;
+}
+
+/**
+ * Writes the point of the query result to the output
+ *
+ * @param output Buffer to append the line to
+ * @param point Aggregated point (it must contain some data)
+ * @param from Start of the queried range (Unix time in seconds)
+ * @param step Length of one step (in seconds)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int history_point_write(struct string_buffer *output, const struct history_point *point, uint64_t from,
+                        uint64_t step) {
+    return string_buffer_printf(output, "%llu %.1f %d %d %llu\r\n", (unsigned long long) (from + point->index * step),
+                                (double) point->sum / (double) point->count, point->min, point->max,
+                                (unsigned long long) point->count);
+}
+
+/**
+ * Adds aggregated CPU load to the point of the query result
+ *
+ * The point is written to the output first if the data belongs to another step.
+ *
+ * @param output Buffer to append the finished point to
+ * @param point Currently aggregated point
+ * @param from Start of the queried range (Unix time in seconds)
+ * @param step Length of one step (in seconds)
+ * @param index Index of the step the data belongs to
+ * @param data Aggregated CPU load to add (the start isn't used)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int history_point_add(struct string_buffer *output, struct history_point *point, uint64_t from, uint64_t step,
+                      uint64_t index, const struct history_rollup *data) {
+    int result = 0;
+
+    if (point->count > 0 && point->index != index) {
+        result = history_point_write(output, point, from, step);
+        point->count = 0;
+    }
+
+    if (point->count == 0) {
+        *point = (struct history_point) {index, 0, data->min, data->max, 0};
+    }
+
+    point->sum += data->sum;
+    point->min = data->min < point->min ? data->min : point->min;
+    point->max = data->max > point->max ? data->max : point->max;
+    point->count += data->count;
+
+    return result;
+}
+
+/**
+ * Aggregates raw records in the range (they are found by binary search)
+ *
+ * @param output Buffer to append the points to
+ * @param point Currently aggregated point
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param step Length of one step (in seconds)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre The lock is held by the caller
+ */
+int history_query_records(struct string_buffer *output, struct history_point *point, uint64_t from, uint64_t to,
+                          uint64_t step) {
+    struct history_codec decoder;
+    struct history_record record;
+    struct history_rollup data = {0, 0, 0, 0, 1, 0};
+    uint64_t count = history_blocks_count();
+    int result = 0;
+
+    for (uint64_t i = history_find_block(from * 1000); i < count && result == 0; i++) {
+        history_codec_init(&decoder);
+        while (result == 0 && history_block_next(history_block_at(i), &decoder, &record)) {
+            if (record.timestamp >= to * 1000) {
+                return result;
+            }
+            if (record.timestamp < from * 1000) {
+                continue;
+            }
+
+            data.sum = data.min = data.max = record.load;
+            result = history_point_add(output, point, from, step, (record.timestamp / 1000 - from) / step, &data);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Aggregates rollups of periods starting in the range
+ *
+ * @param output Buffer to append the points to
+ * @param point Currently aggregated point
+ * @param tier Rollup tier to read
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param step Length of one step (in seconds)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre The lock is held by the caller
+ */
+int history_query_tier(struct string_buffer *output, struct history_point *point, const struct history_tier *tier,
+                       uint64_t from, uint64_t to, uint64_t step) {
+    const struct history_rollup *rollup;
+    uint64_t latest = writer.timestamp / 1000;
+    uint64_t oldest = latest / tier->resolution >= tier->capacity
+                      ? (latest / tier->resolution - tier->capacity + 1) * tier->resolution : 0;
+    // Periods older than the ring have been overwritten already, so they are skipped
+    uint64_t start = (from > oldest ? from : oldest) + tier->resolution - 1;
+    int result = 0;
+
+    to = to < latest + 1 ? to : latest + 1;
+    for (start = start / tier->resolution * tier->resolution; start < to && result == 0; start += tier->resolution) {
+        rollup = &tier->rollups[start / tier->resolution % tier->capacity];
+        if (rollup->count > 0 && rollup->start == start) {
+            result = history_point_add(output, point, from, step, (start - from) / step, rollup);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Checks whether the source (raw records or the rollup tier) still has data of the time
+ *
+ * @param tier Rollup tier (TIERS_COUNT => raw records)
+ * @param time Checked time (Unix time in seconds)
+ * @return Does the source cover the time?
+ * @pre The lock is held by the caller, the history isn't empty
+ */
+bool history_covers(enum history_tier_id tier, uint64_t time) {
+    uint64_t latest = writer.timestamp / 1000;
+
+    if (tier == TIERS_COUNT) {
+        return time >= history_block_at(0)->first_timestamp / 1000;
+    }
+
+    return latest / tiers[tier].resolution < tiers[tier].capacity
+           || time / tiers[tier].resolution > latest / tiers[tier].resolution - tiers[tier].capacity;
+}
+
+/**
+ * Writes aggregated CPU load in the time range to the output
+ *
+ * There is one line per non-empty step: "TIMESTAMP AVG MIN MAX COUNT" (timestamp of the step's start
+ * in Unix seconds). The source is the coarsest rollup tier not coarser than the step (raw records
+ * for steps under a minute), a coarser one is used if the finer one doesn't reach the start of the range.
+ *
+ * @param output Buffer to append the lines to
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param step Length of one step (in seconds, it is raised to keep at most HISTORY_MAX_POINTS points)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre from < to && step > 0
+ */
+int history_query(struct string_buffer *output, uint64_t from, uint64_t to, uint64_t step) {
+    struct history_point point = {0};
+    // TIERS_COUNT => raw records
+    int source = TIERS_COUNT;
+    int result;
+
+    if (history == NULL) {
+        return 0;
+    }
+
+    // Timestamps of records are in milliseconds, so the range must be representable in them
+    to = to < UINT64_MAX / 1000 ? to : UINT64_MAX / 1000;
+    if (from >= to) {
+        return 0;
+    }
+
+    if ((to - from + step - 1) / step > HISTORY_MAX_POINTS) {
+        step = (to - from + HISTORY_MAX_POINTS - 1) / HISTORY_MAX_POINTS;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (history->header.head == 0) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    for (int i = TIERS_COUNT - 1; i >= 0 && source == TIERS_COUNT; i--) {
+        if (tiers[i].resolution <= step) {
+            source = i;
+        }
+    }
+    if (source == TIERS_COUNT && !history_covers(TIERS_COUNT, from)) {
+        source = 0;
+    }
+    while (source < TIERS_COUNT - 1 && !history_covers(source, from)) {
+        source++;
+    }
+
+    if (source == TIERS_COUNT) {
+        result = history_query_records(output, &point, from, to, step);
+    } else {
+        result = history_query_tier(output, &point, &tiers[source], from, to, step);
+    }
+
+    // The last point has no following one that would write it
+    if (result == 0 && point.count > 0) {
+        result = history_point_write(output, &point, from, step);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+/**
+ * Decodes CPU load of raw records in the range to a contiguous array
+ *
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param loads Pointer to the place where to save the array (it must be freed by the caller)
+ * @param count Pointer to the place where to save the number of values
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int history_collect_loads(uint64_t from, uint64_t to, int32_t **loads, size_t *count) {
+    struct history_codec decoder;
+    struct history_record record;
+    size_t capacity = 0;
+    int32_t *resized;
+    bool finished = false;
+
+    *loads = NULL;
+    *count = 0;
+
+    pthread_mutex_lock(&lock);
+
+    for (uint64_t i = history_find_block(from * 1000); i < history_blocks_count() && !finished; i++) {
+        history_codec_init(&decoder);
+        while (!finished && history_block_next(history_block_at(i), &decoder, &record)) {
+            if (record.timestamp >= to * 1000) {
+                finished = true;
+            } else if (record.timestamp >= from * 1000) {
+                if (*count == capacity) {
+                    capacity = capacity > 0 ? capacity * 2 : 1024;
+                    if ((resized = realloc(*loads, capacity * sizeof(**loads))) == NULL) {
+                        pthread_mutex_unlock(&lock);
+                        free(*loads);
+                        *loads = NULL;
+                        return 1;
+                    }
+                    *loads = resized;
+                }
+                (*loads)[(*count)++] = record.load;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+/**
+ * Writes the summary of CPU load in the time range to the output
+ *
+ * The line has format "AVG MIN MAX COUNT PERCENTILE" (nothing is written for an empty range).
+ * Raw records of the range are decoded to an array and aggregated by vectorised kernels,
+ * so the range must be covered by raw records (older ones are already overwritten).
+ *
+ * @param output Buffer to append the line to
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param percentile Wanted percentile (0-100)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre from < to && percentile <= 100
+ */
+int history_summary(struct string_buffer *output, uint64_t from, uint64_t to, unsigned percentile) {
+    const struct aggregation_kernels *kernels = aggregation_kernels();
+    struct load_summary summary;
+    int32_t *loads;
+    size_t count;
+    int result;
+
+    if (history == NULL) {
+        return 0;
+    }
+
+    // Timestamps of records are in milliseconds, so the range must be representable in them
+    to = to < UINT64_MAX / 1000 ? to : UINT64_MAX / 1000;
+    if (from >= to) {
+        return 0;
+    }
+
+    // Kernels run over a private copy, so the sampler isn't blocked by them
+    if (history_collect_loads(from, to, &loads, &count) != 0) {
+        return 1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    kernels->summarize(loads, count, &summary);
+    result = string_buffer_printf(output, "%.1f %d %d %zu %d\r\n", (double) summary.sum / (double) summary.count,
+                                  summary.min, summary.max, summary.count,
+                                  aggregation_percentile(kernels, loads, &summary, percentile));
+
+    free(loads);
+    return result;
+}
@@ -0,0 +1,96 @@
+#ifndef HINFOSVC_HISTORY_H
+#define HINFOSVC_HISTORY_H
+/**
+ * @file history.h
+ * Header of persistent history of CPU load samples
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdint.h>
+#include "string-buffer.h"
+#include "system-info.h"
+#include "history-codec.h"
+
+/**
+ * Number of compressed blocks kept in the history ring (about 4 days of samples taken once per second)
+ */
+#define HISTORY_BLOCKS 1024
+/**
+ * Maximum number of points returned by one history query
+ */
+#define HISTORY_MAX_POINTS 1000
+/**
+ * Default length of the queried time range (in seconds)
+ */
+#define HISTORY_DEFAULT_RANGE 3600
+/**
+ * Default step of the history query (in seconds)
+ */
+#define HISTORY_DEFAULT_STEP 60
+/**
+ * Default length of the summarized time range (in seconds)
+ */
+#define SUMMARY_DEFAULT_RANGE 86400
+/**
+ * Default percentile of the summary
+ */
+#define SUMMARY_DEFAULT_PERCENTILE 95
+
+/**
+ * Opens (or creates) the history ring
+ *
+ * Records from the previous run are kept if the file has the expected format. Otherwise, the file
+ * is reinitialized.
+ *
+ * @param path Path of the history file (NULL => history is kept in memory only)
+ * @return 0 => success, 1 => error
+ */
+int history_open(const char *path);
+
+/**
+ * Unmaps the history ring (and closes its file)
+ */
+void history_close(void);
+
+/**
+ * Appends a sample to the history ring (the oldest record is overwritten when the ring is full)
+ *
+ * @param timestamp Time when the sample was taken (Unix time in milliseconds)
+ * @param load CPU load in %
+ * @param stats CPU statistics the sample was computed from
+ */
+void history_append(uint64_t timestamp, int load, const struct proc_stats *stats);
+
+/**
+ * Writes aggregated CPU load in the time range to the output
+ *
+ * There is one line per non-empty step: "TIMESTAMP AVG MIN MAX COUNT" (timestamp of the step's start
+ * in Unix seconds). The source is the coarsest rollup tier not coarser than the step (raw records
+ * for steps under a minute), a coarser one is used if the finer one doesn't reach the start of the range.
+ *
+ * @param output Buffer to append the lines to
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param step Length of one step (in seconds, it is raised to keep at most HISTORY_MAX_POINTS points)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre from < to && step > 0
+ */
+int history_query(struct string_buffer *output, uint64_t from, uint64_t to, uint64_t step);
+
+/**
+ * Writes the summary of CPU load in the time range to the output
+ *
+ * The line has format "AVG MIN MAX COUNT PERCENTILE" (nothing is written for an empty range).
+ * Raw records of the range are decoded to an array and aggregated by vectorised kernels,
+ * so the range must be covered by raw records (older ones are already overwritten).
+ *
+ * @param output Buffer to append the line to
+ * @param from Start of the range (Unix time in seconds, inclusive)
+ * @param to End of the range (Unix time in seconds, exclusive)
+ * @param percentile Wanted percentile (0-100)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ * @pre from < to && percentile <= 100
+ */
+int history_summary(struct string_buffer *output, uint64_t from, uint64_t to, unsigned percentile);
+
+#endif //HINFOSVC_HISTORY_H
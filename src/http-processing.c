@@ -7,228 +7,940 @@
 #include <time.h>
 #include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
 #include "http-processing.h"
 #include "system-info.h"
+#include "sampler.h"
+#include "trace.h"
+#include "routes.h"
+#include "history.h"
+#include "listener-stats.h"
 
 /**
- * States of the FSM for loading HTTP request
+ * Parameters of 32-bit FNV-1a hash of lowercase header names
  */
-enum loading_state {
-    // Processing of the first row
-    FIRST_ROW_S,
-    // Reading of the header name
-    HEADER_S,
-    // Whitespace characters between header name and its value
-    SPACE_S,
-    // Reading of the header value
-    VALUE_S,
-    // The end of the HTTP head (\r) - just for a check
-    END_S,
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+/**
+ * Time after which a failed collection of the body is retried (in milliseconds)
+ */
+#define FAILED_BODY_RETRY 1000
+
+/**
+ * Name of the captured header field
+ */
+struct header_field_name {
+    // Lowercase name
+    const char *name;
+    // FNV-1a hash of the name
+    unsigned hash;
 };
 
+/**
+ * Body of the route created from a sample of some metric, it is cached until the next sample is due
+ */
+struct cached_body {
+    // Has been the body successfully loaded?
+    bool loaded;
+    // Body of the response (hostname is the longest possible one, \r\n --> +2)
+    char body[HOSTNAME_LENGTH + 1 + 2];
+    // Length of the body
+    size_t length;
+    // ETag of the body (including quotes)
+    char etag[HTTP_ETAG_LEN + 1];
+    // Time when the sample was taken (Unix time in milliseconds, just for Last-Modified and Expires headers)
+    unsigned long long sampled_at;
+    // Time when the body was collected (monotonic time in milliseconds, steps of the wall clock don't expire it)
+    unsigned long long collected_at;
+    // Sampling interval of the metric (in seconds)
+    unsigned interval;
+    // Sequential number of the sample (for samples taken by the sampler)
+    unsigned long long sequence;
+};
+
+/**
+ * Collecting of the body of the route by the offload pool
+ */
+struct collect_job {
+    // Job of the offload pool (it must be the first member)
+    struct offload_job job;
+    // Route whose body is collected
+    const struct route *route;
+    // Is the body being collected? (requests coming meanwhile wait for the same result)
+    bool running;
+    // Requests waiting for the body
+    struct collect_waiter *waiters;
+    // Result of the collector (0 => success)
+    int result;
+    // Data loaded by the collector
+    char data[HOSTNAME_LENGTH + 1];
+};
+
+/**
+ * Bodies of cacheable routes loaded at start (indexed by route identifiers), workers start with their copies
+ */
+static struct cached_body initial_bodies[ROUTES_COUNT];
+/**
+ * Cached bodies of cacheable routes (indexed by route identifiers), each worker has its own cache
+ */
+static __thread struct cached_body cached_bodies[ROUTES_COUNT];
+/**
+ * Collecting of bodies of blocking routes (indexed by route identifiers), each worker has its own jobs
+ */
+static __thread struct collect_job collect_jobs[ROUTES_COUNT];
+/**
+ * Completions of the worker for jobs of the offload pool (NULL => collectors are called by the worker)
+ */
+static __thread struct offload_completions *thread_completions = NULL;
+/**
+ * Requests whose bodies have been collected (they are processed again by the worker)
+ */
+static __thread struct collect_waiter *collected_waiters = NULL;
+/**
+ * Maximum length of the first line of HTTP request
+ */
+static size_t request_line_limit = DEFAULT_MAX_REQUEST_LINE;
+/**
+ * Maximum length of the header section of HTTP request
+ */
+static size_t headers_limit = DEFAULT_MAX_HEADERS;
+/**
+ * Names of captured header fields (indexed by slots)
+ */
+static const struct header_field_name header_fields[HEADER_FIELDS_COUNT] = {
+        [HOST_F] = {"host", 0xaffea56fU},
+        [CONNECTION_F] = {"connection", 0x38b99ed9U},
+        [ACCEPT_F] = {"accept", 0x08247e29U},
+        [IF_NONE_MATCH_F] = {"if-none-match", 0x972b6177U},
+        [ACCEPT_ENCODING_F] = {"accept-encoding", 0xc9715a99U},
+        [REQUEST_TIMEOUT_F] = {"x-request-timeout", 0x72faf2adU},
+};
+
+/**
+ * Sets sampling interval of CPU load, responses of /load can be cached for this time
+ *
+ * @param seconds Sampling interval (in seconds)
+ */
+void set_load_sample_interval(unsigned seconds) {
+    initial_bodies[LOAD_R].interval = seconds;
+}
+
+/**
+ * Returns current Unix time with millisecond precision
+ *
+ * @return Current time in milliseconds
+ */
+unsigned long long get_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in milliseconds
+ */
+unsigned long long get_monotonic_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+}
+
+/**
+ * Formats the datetime to HTTP's header format
+ *
+ * @param epoch_time Datetime to format (Unix time)
+ * @param formatted_datetime Pointer to the place where to save (return) the datetime
+ */
+void format_http_datetime(time_t epoch_time, char *formatted_datetime) {
+    struct tm gmt;
+
+    gmtime_r(&epoch_time, &gmt);
+
+    strftime(formatted_datetime, HTTP_DATETIME_LEN + 1, "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+}
+
 /**
  * Constructs and returns current datetime in HTTP's header format
  *
  * @param formatted_datetime Pointer to the place where to save (return) the datetime
  */
 void get_http_datetime(char *formatted_datetime) {
-    time_t epoch_time;
-    struct tm *gmt;
+    format_http_datetime(time(NULL), formatted_datetime);
+}
+
+/**
+ * Sets limits of HTTP requests (they must be set before loading of the first request)
+ *
+ * @param max_request_line Maximum length of the first line of the request
+ * @param max_headers Maximum length of the header section of the request
+ */
+void set_http_limits(size_t max_request_line, size_t max_headers) {
+    request_line_limit = max_request_line;
+    headers_limit = max_headers;
+}
 
-    time(&epoch_time);
-    gmt = gmtime(&epoch_time);
+/**
+ * Returns the capacity of the buffer needed for the HTTP head (the limits are always exceeded before it is full)
+ *
+ * @return Capacity of the buffer (in bytes)
+ */
+size_t http_head_capacity(void) {
+    // The line can end by \r\n and the first byte over the limit of headers must be loaded to detect it
+    return request_line_limit + 2 + headers_limit + 1;
+}
 
-    strftime(formatted_datetime, HTTP_DATETIME_LEN, "%a, %d %b %Y %H:%M:%S", gmt);
+/**
+ * Prepares the parser for loading a new HTTP request
+ *
+ * @param parser Parser to init
+ * @param head Buffer where the HTTP head is received
+ * @param capacity Capacity of the buffer
+ */
+void http_parser_init(struct http_parser *parser, const char *head, size_t capacity) {
+    parser->state = FIRST_ROW_S;
+    parser->head = head;
+    parser->head_capacity = capacity;
+    parser->head_length = 0;
+    parser->line_length = 0;
+    parser->headers_length = 0;
+    parser->name_hash = FNV_OFFSET_BASIS;
+    parser->name_start = 0;
+    parser->value_field = HEADER_FIELDS_COUNT;
+    parser->value_start = 0;
+    memset(parser->fields, 0, sizeof(parser->fields));
 }
 
 /**
- * Goes throw buffer and increments its index until whitespaces are read
+ * Finds the slot of the header field
  *
- * @param buffer Buffer to work with
- * @param index Index of the buffer (pointer to it)
+ * @param parser Parser with the loaded header name
+ * @param name_end Offset of the end of the header name
+ * @return Slot of the field or HEADER_FIELDS_COUNT if the field isn't captured
  */
-void skip_whitespaces(const char *buffer, unsigned *index) {
-    while (isspace(buffer[(*index)++])) {
-        ; // Just skipping whitespace characters
+enum header_field find_header_field(const struct http_parser *parser, size_t name_end) {
+    size_t length = name_end - parser->name_start;
+
+    for (unsigned field = 0; field < HEADER_FIELDS_COUNT; field++) {
+        // Names are compared only if their hashes match (that is unlikely for other fields)
+        if (header_fields[field].hash == parser->name_hash && strlen(header_fields[field].name) == length
+            && strncasecmp(&parser->head[parser->name_start], header_fields[field].name, length) == 0) {
+            return (enum header_field) field;
+        }
     }
 
-    // The last tries char wasn't whitespace, it needs to be recovered
-    (*index)--;
+    return HEADER_FIELDS_COUNT;
 }
 
 /**
- * Loads an HTTP request from the opened socket
+ * Saves the value of the header field to its slot (if the field is captured and it isn't there yet)
  *
- * @param conn_socket Open socket identifier
- * @param request_buffer Buffer where the first line will be written to
- * @return 0 => success, 1 => socket error, 2 => bad HTTP format
+ * @param parser Parser with the loaded header value
+ * @param value_end Offset of the end of the line with the value
  */
-int load_http_request(int conn_socket, char *request_buffer) {
-    enum loading_state state = FIRST_ROW_S;
-    int read_bytes;
-    int buffer_index = 0;
+void capture_header_field(struct http_parser *parser, size_t value_end) {
+    // Line ending and trailing whitespaces aren't part of the value
+    while (value_end > parser->value_start && isspace(parser->head[value_end - 1])) {
+        value_end--;
+    }
+
+    if (parser->value_field != HEADER_FIELDS_COUNT && parser->fields[parser->value_field].data == NULL) {
+        parser->fields[parser->value_field].data = &parser->head[parser->value_start];
+        parser->fields[parser->value_field].length = value_end - parser->value_start;
+    }
+    parser->value_field = HEADER_FIELDS_COUNT;
+}
+
+/**
+ * Feeds the FSM for loading HTTP request with the next part of the request
+ *
+ * The part must already be stored in the buffer of the parser right after the previously loaded data.
+ *
+ * @param parser Parser state (from the previous calls)
+ * @param length Length of the next part of the HTTP request
+ * @param consumed Pointer to the place where to save number of used bytes (the rest belongs to the next request)
+ * @return 0 => the whole HTTP head has been loaded, 2 => bad HTTP format, 3 => more data needed,
+ *         4 => the first line is too long, 5 => the header section is too long
+ */
+int http_parser_feed(struct http_parser *parser, size_t length, size_t *consumed) {
+    // Counters are kept in locals, so the loop doesn't reload members of the parser after each byte
+    const char *data = &parser->head[parser->head_length];
+    size_t base = parser->head_length;
+    const char *line_end;
+    size_t headers_left;
+    size_t index = 0;
+    int result = 3;
     char c;
 
-    while ((read_bytes = (int)read(conn_socket, &c, 1)) == 1) {
-        switch (state) {
+    // Data behind the buffer can't be loaded (the limits are exceeded before the buffer is full)
+    if (length > parser->head_capacity - parser->head_length) {
+        length = parser->head_capacity - parser->head_length;
+    }
+
+    // The first line isn't copied anywhere, so just its end is searched
+    if (parser->state == FIRST_ROW_S) {
+        if ((line_end = memchr(data, '\n', length)) == NULL) {
+            parser->head_length += length;
+            *consumed = length;
+            // The line is too long even with \r, the rest of it isn't loaded at all
+            return parser->head_length > request_line_limit + 1 ? 4 : 3;
+        }
+
+        index = (size_t) (line_end - data) + 1;
+        // Line ending (\r\n or bare \n) isn't part of the line
+        parser->line_length = parser->head_length + index - 1;
+        if (parser->line_length > 0 && parser->head[parser->line_length - 1] == '\r') {
+            parser->line_length--;
+        }
+        if (parser->line_length > request_line_limit) {
+            parser->head_length += index;
+            *consumed = index;
+            return 4;
+        }
+        parser->name_start = parser->head_length + index;
+        parser->state = HEADER_S;
+    }
+
+    headers_left = headers_limit - parser->headers_length;
+    for (; index < length && result == 3; index++) {
+        c = data[index];
+
+        if (headers_left == 0) {
+            result = 5;
+            continue;
+        }
+        headers_left--;
+
+        switch (parser->state) {
             case FIRST_ROW_S:
-                if (c == '\n') {
-                    state = HEADER_S;
-                } else {
-                    if (buffer_index < MAX_MSG_LINE_LEN) {
-                        request_buffer[buffer_index++] = c;
-                    } else {
-                        // Maximum size of the first line has been reached, longer lines can't be processed
-                        return 2;
-                    }
-                    state = FIRST_ROW_S;
-                }
+                // The first line has been already loaded
                 break;
             case HEADER_S:
                 if ((isalnum(c) || c == '-') && c != ':') {
-                    state = HEADER_S;
+                    // The name stays in the buffer, just its hash is computed on the way
+                    parser->name_hash = (parser->name_hash ^ (unsigned char) tolower(c)) * FNV_PRIME;
+                    parser->state = HEADER_S;
                 } else if (c == ':') {
-                    state = SPACE_S;
+                    parser->value_field = find_header_field(parser, base + index);
+                    parser->name_hash = FNV_OFFSET_BASIS;
+                    parser->state = SPACE_S;
                 } else if (c == '\r') {
                     // At the end of the HTTP head must be [\r]\n ([...] is selector)
-                    state = END_S;
+                    parser->state = END_S;
                 } else {
                     // Header must contain only alphanumeric chars and -
-                    return 2;
+                    result = 2;
                 }
                 break;
             case SPACE_S:
-                if (isspace(c)) {
-                    state = SPACE_S;
+                if (c == '\n') {
+                    // Empty value
+                    parser->value_start = base + index;
+                    capture_header_field(parser, base + index);
+                    parser->name_start = base + index + 1;
+                    parser->state = HEADER_S;
+                } else if (isspace(c)) {
+                    parser->state = SPACE_S;
                 } else {
-                    state = VALUE_S;
+                    parser->value_start = base + index;
+                    parser->state = VALUE_S;
                 }
                 break;
             case VALUE_S:
                 if (c != '\n') {
-                    state = VALUE_S;
+                    parser->state = VALUE_S;
                 } else {
-                    state = HEADER_S;
+                    capture_header_field(parser, base + index);
+                    parser->name_start = base + index + 1;
+                    parser->state = HEADER_S;
                 }
                 break;
             case END_S:
-                if (c == '\n') {
-                    return 0;
-                } else {
-                    // At the end of the HTTP head must be \r[\n] ([...] is selector)
-                    return 2;
-                }
+                // At the end of the HTTP head must be \r[\n] ([...] is selector)
+                result = c == '\n' ? 0 : 2;
+                break;
         }
     }
 
-    // System error while reading socket
-    if (read_bytes == -1) {
-        return 1;
-    }
+    parser->head_length += index;
+    parser->headers_length = headers_limit - headers_left;
+    *consumed = index;
+    return result;
+}
 
-    // read_bytes == 0 --> End of the HTTP request but the HTTP head wasn't correctly ended
-    return 2;
+/**
+ * Checks if the view contains the string
+ *
+ * @param view View to check
+ * @param str String to compare with
+ * @return Are they equal?
+ */
+bool view_equals(const struct http_view *view, const char *str) {
+    return view->length == strlen(str) && memcmp(view->data, str, view->length) == 0;
 }
 
 /**
- * Parses HTTP request and retrieves parsed data
+ * Moves the index behind the item (sequence of non-whitespace characters)
  *
- * @param http_request Buffer with the first line of the HTTP request
- * @param method Pointer to the place where to save parsed HTTP method
- * @param uri Pointer to the place where to save parsed HTTP URI
- * @param version Pointer to the place where to save parsed HTTP version
- * @return Error code (equals to HTTP error code number --> 200 => success, etc.)
+ * @param line Line with the item
+ * @param length Length of the line
+ * @param index Index of the line (pointer to it)
+ * @param item Pointer to the place where to save view of the item
  */
-unsigned parse_http_request(const char *http_request, char *method, char *uri, char *version) {
-    unsigned local_ix;
-    unsigned req_ix = 0;
+void read_item(const char *line, size_t length, size_t *index, struct http_view *item) {
+    item->data = &line[*index];
+    while (*index < length && !isspace(line[*index])) {
+        (*index)++;
+    }
+    item->length = (size_t) (&line[*index] - item->data);
+}
 
-    // HTTP method
-    for (local_ix = 0; local_ix < HTTP_METHOD_LEN; local_ix++) {
-        method[local_ix] = http_request[req_ix++];
+/**
+ * Moves the index behind whitespace characters
+ *
+ * @param line Line with the whitespace characters
+ * @param length Length of the line
+ * @param index Index of the line (pointer to it)
+ */
+void skip_whitespaces(const char *line, size_t length, size_t *index) {
+    while (*index < length && isspace(line[*index])) {
+        (*index)++;
     }
-    method[HTTP_METHOD_LEN] = '\0';
+}
+
+/**
+ * Parses the first line of HTTP request
+ *
+ * @param line The first line of the HTTP request (without the line ending)
+ * @param length Length of the line
+ * @param request Pointer to the place where to save views of the parsed items
+ * @return Error code (equals to HTTP error code number --> 200 => success, etc.)
+ */
+unsigned parse_http_request(const char *line, size_t length, struct http_request_line *request) {
+    size_t index = 0;
 
-    if (strcmp(method, "GET") != 0) {
-        // Forbidden method
+    // HTTP method (it must be followed by a whitespace)
+    read_item(line, length, &index, &request->method);
+    if (index == length || (!view_equals(&request->method, "GET") && !view_equals(&request->method, "HEAD")
+                            && !view_equals(&request->method, "OPTIONS"))) {
         return 405;
     }
 
     // There should be at least one whitespace we need to skip
-    skip_whitespaces(http_request, &req_ix);
-
-    // HTTP URI
-    for (local_ix = 0; local_ix < HTTP_URI_LEN; local_ix++) {
-        if (!isspace(http_request[req_ix])) {
-            uri[local_ix] = http_request[req_ix++];
-        } else {
-            // Whitespace char mean the end of the URI item
+    skip_whitespaces(line, length, &index);
+    read_item(line, length, &index, &request->target);
+    skip_whitespaces(line, length, &index);
+
+    // HTTP version (trailing whitespaces aren't part of it)
+    read_item(line, length, &index, &request->version);
+    skip_whitespaces(line, length, &index);
+
+    if (index != length || !view_equals(&request->version, "HTTP/1.1")) {
+        // Unsupported HTTP version (or something behind it)
+        return 505;
+    }
+
+    // OK
+    return 200;
+}
+
+/**
+ * Loads and parses the HTTP request stored in memory (no socket is needed)
+ *
+ * @param data Complete HTTP request (the head at least)
+ * @param length Length of the data
+ * @param request Pointer to the place where to save views of the parsed items (they point to the data)
+ * @return Error code (equals to HTTP error code number --> 200 => success, etc.)
+ */
+unsigned parse_http_message(const char *data, size_t length, struct http_request_line *request) {
+    struct http_parser parser;
+    size_t consumed;
+
+    // The data are the buffer of the parser, so nothing is copied
+    http_parser_init(&parser, data, length);
+
+    switch (http_parser_feed(&parser, length, &consumed)) {
+        case 0:
+            return parse_http_request(parser.head, parser.line_length, request);
+        case 4:
+            return 414;
+        case 5:
+            return 431;
+        default:
+            // Bad format or incomplete HTTP head
+            return 400;
+    }
+}
+
+/**
+ * Splits HTTP request target into the path and the query string
+ *
+ * @param target Request target
+ * @param path Pointer to the place where to save the path
+ * @param query Pointer to the place where to save the query string (without '?', empty if the target has no query)
+ */
+void split_target(const struct http_view *target, struct http_view *path, struct http_view *query) {
+    const char *query_start = memchr(target->data, '?', target->length);
+
+    path->data = target->data;
+    path->length = query_start != NULL ? (size_t) (query_start - target->data) : target->length;
+    query->data = query_start != NULL ? query_start + 1 : &target->data[target->length];
+    query->length = query_start != NULL ? target->length - path->length - 1 : 0;
+}
+
+/**
+ * Finds a numeric parameter in the query string
+ *
+ * @param query Query string (without '?')
+ * @param name Name of the parameter
+ * @param value Pointer to the place where to save the value of the parameter
+ * @return Has been the parameter found?
+ */
+bool get_query_ul(const struct http_view *query, const char *name, unsigned long *value) {
+    size_t name_len = strlen(name);
+    const char *param = query->data;
+    const char *query_end = &query->data[query->length];
+    const char *param_end;
+    const char *digit;
+
+    while (param < query_end) {
+        if ((param_end = memchr(param, '&', (size_t) (query_end - param))) == NULL) {
+            param_end = query_end;
+        }
+
+        if ((size_t) (param_end - param) > name_len && strncmp(param, name, name_len) == 0
+            && param[name_len] == '=') {
+            // Value must be a number and nothing else (too big numbers saturate like strtoul())
+            *value = 0;
+            for (digit = &param[name_len + 1]; digit < param_end && isdigit(*digit); digit++) {
+                *value = *value > (ULONG_MAX - (unsigned long) (*digit - '0')) / 10
+                         ? ULONG_MAX : *value * 10 + (unsigned long) (*digit - '0');
+            }
+
+            return digit != &param[name_len + 1] && digit == param_end;
+        }
+
+        // Move to the next parameter
+        param = param_end + 1;
+    }
+
+    return false;
+}
+
+/**
+ * Computes ETag of the body (FNV-1a hash, so it is stable across restarts of the server)
+ *
+ * @param body Body of the response
+ * @param length Length of the body
+ * @param etag Pointer to the place where to save the ETag (including quotes)
+ */
+void compute_etag(const char *body, size_t length, char *etag) {
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) body[i];
+        hash *= 1099511628211ULL;
+    }
+
+    sprintf(etag, "\"%016llx\"", hash);
+}
+
+/**
+ * Checks if the value of If-None-Match header matches the ETag
+ *
+ * @param if_none_match Value of If-None-Match header (list of ETags or *, no data => the header is missing)
+ * @param etag ETag of the current body (including quotes)
+ * @return Does the header match the ETag?
+ */
+bool etag_matches(const struct http_view *if_none_match, const char *etag) {
+    size_t etag_len = strlen(etag);
+    const char *item = if_none_match->data;
+    const char *end = &if_none_match->data[if_none_match->length];
+
+    while (item < end) {
+        // Skip separators between items
+        while (item < end && (*item == ',' || isspace(*item))) {
+            item++;
+        }
+
+        if (item < end && *item == '*') {
+            return true;
+        }
+
+        // Weak comparison is used (see RFC 7232, section 3.2) --> W/ prefix doesn't matter
+        if (end - item >= 2 && strncmp(item, "W/", 2) == 0) {
+            item += 2;
+        }
+
+        if ((size_t) (end - item) >= etag_len && strncmp(item, etag, etag_len) == 0
+            && (item + etag_len == end || item[etag_len] == ',' || isspace(item[etag_len]))) {
+            return true;
+        }
+
+        // Move to the next item
+        if ((item = memchr(item, ',', (size_t) (end - item))) == NULL) {
             break;
         }
     }
-    memset(&uri[local_ix], '\0', HTTP_URI_LEN - strlen(uri));
 
-    if (!isspace(http_request[req_ix])) {
-        // HTTP URI is longer than maximum
-        return 414;
+    return false;
+}
+
+/**
+ * Checks whether the sample in the cache has expired (the body must be collected again)
+ *
+ * @param cache Cache of the body
+ * @return Has the sample expired?
+ */
+bool cached_body_expired(const struct cached_body *cache) {
+    // Failed loading is retried after a while, so a failing collector isn't called by every request
+    unsigned long long valid_for = cache->loaded ? cache->interval * 1000ULL : FAILED_BODY_RETRY;
+
+    return get_monotonic_time_ms() >= cache->collected_at + valid_for;
+}
+
+/**
+ * Stores the collected data to the cache of the body
+ *
+ * @param cache Cache of the body
+ * @param result Result of the collector (0 => success)
+ * @param data Data loaded by the collector
+ */
+void store_cached_body(struct cached_body *cache, int result, const char *data) {
+    // The sample is valid from the end of measuring
+    cache->sampled_at = get_time_ms();
+    cache->collected_at = get_monotonic_time_ms();
+    cache->length = sprintf(cache->body, "%s\r\n", data);
+    compute_etag(cache->body, cache->length, cache->etag);
+    cache->loaded = result == 0;
+}
+
+/**
+ * Loads the body of the route (from cache if the sample of the metric is still valid)
+ *
+ * @param cache Cache of the body
+ * @param collector Function for getting the data of the body
+ * @param collector_name Name of the collector function (for tracing)
+ * @param trace Trace record of the request
+ */
+void load_cached_body(struct cached_body *cache, int (*collector)(char *), const char *collector_name,
+                      struct trace_record *trace) {
+    char data[HOSTNAME_LENGTH + 1] = "";
+    int result;
+
+    if (!cached_body_expired(cache)) {
+        return;
     }
 
-    // There should be at least one whitespace we need to skip
-    skip_whitespaces(http_request, &req_ix);
+    trace_set_collector(trace, collector_name);
+    trace_mark(trace, TRACE_COLLECT_START);
+    result = collector(data);
+    trace_mark(trace, TRACE_COLLECT_END);
+
+    store_cached_body(cache, result, data);
+}
 
-    // HTTP version
-    for (local_ix = 0; local_ix < HTTP_VERSION_LEN; local_ix++) {
-        version[local_ix] = http_request[req_ix++];
+/**
+ * Calls the collector of the job (in a thread of the offload pool)
+ *
+ * @param job Collecting job
+ */
+void collect_work(struct offload_job *job) {
+    struct collect_job *collect = (struct collect_job *) job;
+
+    collect->data[0] = '\0';
+    collect->result = collect->route->collector(collect->data);
+}
+
+/**
+ * Inserts the request to the list
+ *
+ * @param list Head of the list
+ * @param waiter Request to insert
+ */
+void collect_waiter_add(struct collect_waiter **list, struct collect_waiter *waiter) {
+    waiter->prev = NULL;
+    waiter->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = waiter;
     }
+    *list = waiter;
+    waiter->list = list;
+}
 
-    if (strcmp(version, "HTTP/1.1") != 0) {
-        // Unsupported HTTP version
-        return 505;
+/**
+ * Stops waiting of the request for the collected body (the request is aborted)
+ *
+ * @param waiter Request to remove (removing of a request that doesn't wait does nothing)
+ */
+void collect_waiter_remove(struct collect_waiter *waiter) {
+    if (waiter->list == NULL) {
+        return;
     }
 
-    // OK
-    return 200;
+    if (waiter->prev != NULL) {
+        waiter->prev->next = waiter->next;
+    } else {
+        *waiter->list = waiter->next;
+    }
+    if (waiter->next != NULL) {
+        waiter->next->prev = waiter->prev;
+    }
+
+    waiter->prev = NULL;
+    waiter->next = NULL;
+    waiter->list = NULL;
 }
 
 /**
- * Processes single HTTP request and prepares a response for it
+ * Takes the next request whose body has been collected by the offload pool (see offload_complete())
  *
- * @param conn_socket Identifier of the socket used for loading HTTP request
- * @param http_response Buffer where to save complete HTTP response
- * @return 0 => success, 1 => error
+ * @return Woken up request or NULL if there is none
  */
-int process_http_request(int conn_socket, char *http_response) {
-    char request_buffer[MAX_MSG_LINE_LEN + 1] = "";
+struct collect_waiter *take_collected_waiter(void) {
+    struct collect_waiter *waiter = collected_waiters;
 
-    char method[HTTP_METHOD_LEN + 1] = "";
-    char uri[HTTP_URI_LEN + 1] = "";
-    char version[HTTP_VERSION_LEN + 1] = "";
+    if (waiter != NULL) {
+        collect_waiter_remove(waiter);
+    }
 
-    int loading_result;
-    unsigned status_code;
-    char status_msg[HTTP_STATE_MSG_LEN + 1] = "OK";
-    char datetime[HTTP_DATETIME_LEN + 1];
-    char data[HOSTNAME_LENGTH + 1] = "";
-    char response_body[HOSTNAME_LENGTH + 1 + 2] = ""; // Hostname is the longest possible body type, \r\n --> +2
+    return waiter;
+}
+
+/**
+ * Stores the body collected by the offload pool to the cache of the worker and wakes up requests waiting for it
+ *
+ * @param job Finished collecting job
+ */
+void collect_complete(struct offload_job *job) {
+    struct collect_job *collect = (struct collect_job *) job;
+    struct collect_waiter *waiter;
+
+    store_cached_body(&cached_bodies[collect->route->id], collect->result, collect->data);
+    collect->running = false;
+
+    // Requests waiting for other bodies aren't touched
+    while ((waiter = collect->waiters) != NULL) {
+        collect_waiter_remove(waiter);
+        collect_waiter_add(&collected_waiters, waiter);
+    }
+}
+
+/**
+ * Starts collecting of the body of the route by the offload pool (unless it is being collected already)
+ *
+ * @param route Route with blocking collector
+ * @param trace Trace record of the request (the end of collecting is marked by the worker)
+ * @param waiter Waiting of the request for the body
+ * @return 0 => the body is being collected (the request waits), 1 => error (there is no offload pool, collect
+ *         the body directly)
+ */
+int collect_offloaded(const struct route *route, struct trace_record *trace, struct collect_waiter *waiter) {
+    struct collect_job *collect = &collect_jobs[route->id];
 
-    // Load HTTP request data
-    loading_result = load_http_request(conn_socket, request_buffer);
+    if (!collect->running) {
+        collect->job.work = collect_work;
+        collect->job.complete = collect_complete;
+        collect->route = route;
+        if (offload_submit(&collect->job, thread_completions) != 0) {
+            return 1;
+        }
+        collect->running = true;
+    }
+    collect_waiter_add(&collect->waiters, waiter);
+
+    trace_set_collector(trace, route->collector_name);
+    trace_mark(trace, TRACE_COLLECT_START);
+    return 0;
+}
 
-    // Loading ended with system error, we can't continue with processing
-    if (loading_result == 1) {
+/**
+ * Refreshes the body of /load route from the latest sample of the sampler
+ *
+ * @param trace Trace record of the request
+ * @return Is any sample available?
+ */
+bool refresh_load_body(struct trace_record *trace) {
+    struct cached_body *cpu_load_body = &cached_bodies[LOAD_R];
+    struct cpu_load_sample sample;
+
+    trace_set_collector(trace, "sampler_get");
+    trace_mark(trace, TRACE_COLLECT_START);
+    sampler_demand();
+    if (!sampler_get(&sample)) {
+        trace_mark(trace, TRACE_COLLECT_END);
+        return false;
+    }
+    trace_mark(trace, TRACE_COLLECT_END);
+
+    // The body is rebuilt only when the sampler has taken a new sample
+    if (!cpu_load_body->loaded || cpu_load_body->sequence != sample.sequence) {
+        cpu_load_body->sequence = sample.sequence;
+        cpu_load_body->sampled_at = sample.sampled_at;
+        cpu_load_body->length = sprintf(cpu_load_body->body, "%d%%\r\n", sample.load);
+        compute_etag(cpu_load_body->body, cpu_load_body->length, cpu_load_body->etag);
+        cpu_load_body->loaded = true;
+    }
+
+    return true;
+}
+
+/**
+ * Formats an event of CPU load stream (text/event-stream) if there is a new sample
+ *
+ * @param output Buffer where to append the event
+ * @param last_sequence Sequential number of the last sent sample (it is updated)
+ * @return 0 => event has been formatted, 1 => no new sample is available
+ */
+int format_load_event(struct string_buffer *output, unsigned long long *last_sequence) {
+    struct cpu_load_sample sample;
+
+    // Open streams keep lazy sampler running
+    sampler_demand();
+
+    // Only the latest sample is sent, intermediate ones are dropped for slow consumers
+    if (!sampler_get(&sample) || sample.sequence == *last_sequence) {
+        return 1;
+    }
+
+    *last_sequence = sample.sequence;
+    return string_buffer_printf(output, "id: %llu\ndata: %d%%\n\n", sample.sequence, sample.load);
+}
+
+/**
+ * Prepares the route table and loads bodies of static routes in advance,
+ * so even the first HEAD request has all the headers
+ *
+ * @return 0 => success, 1 => error
+ */
+int init_routes(void) {
+    struct trace_record trace = {0};
+
+    if (routes_init() != 0) {
         return 1;
     }
 
+    for (int i = 0; i < ROUTES_COUNT; i++) {
+        if (routes[i].collector != NULL) {
+            // Counters change all the time, their samples are valid just briefly
+            initial_bodies[i].interval = i == TCP_STATS_R ? COUNTER_SAMPLE_INTERVAL : STATIC_SAMPLE_INTERVAL;
+            load_cached_body(&initial_bodies[i], routes[i].collector, routes[i].collector_name, &trace);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Inits caches of the calling thread (worker) by bodies loaded by init_routes()
+ *
+ * @param completions Completions of the worker for bodies collected by the offload pool (NULL => collectors
+ *                    are called by the worker)
+ */
+void init_thread_caches(struct offload_completions *completions) {
+    memcpy(cached_bodies, initial_bodies, sizeof(cached_bodies));
+    thread_completions = completions;
+}
+
+/**
+ * Prints caching headers (Cache-Control, Expires, Last-Modified) derived from the sample of the body
+ *
+ * @param http_response Buffer where to print the headers
+ * @param cache Cache of the body
+ */
+void print_caching_headers(struct string_buffer *http_response, const struct cached_body *cache) {
+    unsigned long long expires_at = cache->sampled_at + cache->interval * 1000ULL;
+    unsigned long long now = get_time_ms();
+    char last_modified[HTTP_DATETIME_LEN + 1];
+    char expires[HTTP_DATETIME_LEN + 1];
+
+    // Failed samples mustn't be cached by anybody
+    if (!cache->loaded) {
+        string_buffer_printf(http_response, "Cache-Control: no-store\r\n");
+        return;
+    }
+
+    format_http_datetime((time_t) (cache->sampled_at / 1000), last_modified);
+    format_http_datetime((time_t) (expires_at / 1000), expires);
+
+    string_buffer_printf(http_response,
+                         "Cache-Control: public, max-age=%llu\r\n"
+                         "Expires: %s\r\n"
+                         "Last-Modified: %s\r\n",
+                         expires_at > now ? (expires_at - now) / 1000 : 0, expires, last_modified);
+}
+
+/**
+ * Processes single loaded HTTP request and prepares a response for it
+ *
+ * @param parser Parser the HTTP request has been loaded by
+ * @param loading_result Result of loading the request (0 => success, 2 => bad HTTP format)
+ * @param http_response Buffer where to save complete HTTP response
+ * @param trace Trace record of the request
+ * @param waiter Waiting of the request for the collected body (it waits when 4 is returned)
+ * @return 0 => success, 1 => error, 2 => no sample of CPU load is available yet (process it again after
+ *         the next sample), 3 => the response is the head of CPU load event stream (connection stays open),
+ *         4 => the body is being collected by the offload pool (process it again when the waiter is taken
+ *         by take_collected_waiter())
+ */
+int process_http_request(const struct http_parser *parser, int loading_result, struct string_buffer *http_response,
+                         struct trace_record *trace, struct collect_waiter *waiter) {
+    struct http_request_line request = {0};
+    struct http_view path = {0};
+    struct http_view query = {0};
+
+    unsigned status_code;
+    char status_msg[HTTP_STATE_MSG_LEN + 1] = "OK";
+    const char *content_type = "text/plain";
+    char datetime[HTTP_DATETIME_LEN + 1];
+    struct string_buffer response_body;
+    const struct route *route = NULL;
+    struct cached_body *cached_body = NULL;
+    bool head_only = false;
+    long content_length;
+    unsigned long trace_seconds;
+    unsigned long history_from, history_to, history_step;
+    unsigned long percentile;
+
     // Parse HTTP request
     if (loading_result == 0) {
-        status_code = parse_http_request(request_buffer, method, uri, version);
+        status_code = parse_http_request(parser->head, parser->line_length, &request);
+        trace_mark(trace, TRACE_PARSE_END);
+    } else if (loading_result == 4) {
+        status_code = 414;
+    } else if (loading_result == 5) {
+        status_code = 431;
     } else {
         // Loading detected invalid HTTP request structure
         status_code = 400;
     }
 
+    if (status_code == 200) {
+        split_target(&request.target, &path, &query);
+        head_only = view_equals(&request.method, "HEAD");
+
+        // Debug routes are available only when they are turned on
+        route = find_route(path.data, path.length);
+        if (route != NULL && route->id == DEBUG_TRACE_R && !trace_is_enabled()) {
+            route = NULL;
+        }
+    }
+
+    // Body is preallocated by the route's metadata (the longest error body is short)
+    if (string_buffer_init(&response_body, route != NULL && route->max_body_length > 0
+                                           ? route->max_body_length + 1 : HOSTNAME_LENGTH + 1 + 2) != 0) {
+        return 1;
+    }
+
     // Process parsed data
     if (status_code == 400) {
         sprintf(status_msg, "Bad Request");
@@ -236,36 +948,145 @@ int process_http_request(int conn_socket, char *http_response) {
         sprintf(status_msg, "Method Not Allowed");
     } else if (status_code == 414) {
         sprintf(status_msg, "URI Too Long");
+    } else if (status_code == 431) {
+        sprintf(status_msg, "Request Header Fields Too Large");
     } else if (status_code == 505) {
         sprintf(status_msg, "HTTP Version Not Supported");
+    } else if (route == NULL && (!view_equals(&path, "*") || !view_equals(&request.method, "OPTIONS"))) {
+        status_code = 404;
+        sprintf(status_msg, "Not Found");
+    } else if (view_equals(&request.method, "OPTIONS")) {
+        // Just a description of the communication options, no data are needed
+        status_code = 204;
+        sprintf(status_msg, "No Content");
     } else {
         // status_code == 200
-        if (strcmp(uri, "/hostname") == 0) {
-            get_hostname(data);
-            sprintf(response_body, "%s\r\n", data);
-        } else if (strcmp(uri, "/cpu-name") == 0) {
-            get_cpu_info(data);
-            sprintf(response_body, "%s\r\n", data);
-        } else if (strcmp(uri, "/load") == 0) {
-            sprintf(response_body, "%d%%\r\n", get_cpu_load());
-        } else {
-            status_code = 404;
-            sprintf(status_msg, "Not Found");
+        content_type = route->content_type;
+        if (route->cacheable) {
+            cached_body = &cached_bodies[route->id];
+        }
+
+        if (cached_body != NULL) {
+            // HEAD requests are answered from the last sample, so no collector is invoked for them
+            if (!head_only && route->collector != NULL) {
+                // Blocking collector would stall all connections of the worker, so the request waits for the pool
+                if (route->blocking && cached_body_expired(cached_body)
+                    && collect_offloaded(route, trace, waiter) == 0) {
+                    string_buffer_free(&response_body);
+                    return 4;
+                }
+                load_cached_body(cached_body, route->collector, route->collector_name, trace);
+            } else if (!head_only && route->id == LOAD_R && !refresh_load_body(trace)) {
+                // CPU load is measured in the background, the request must wait for the first sample
+                string_buffer_free(&response_body);
+                return 2;
+            }
+
+            // Client already has the current version of the body --> it isn't sent again
+            if (cached_body->loaded && etag_matches(&parser->fields[IF_NONE_MATCH_F], cached_body->etag)) {
+                status_code = 304;
+                sprintf(status_msg, "Not Modified");
+            } else {
+                string_buffer_append(&response_body, cached_body->body, cached_body->length);
+            }
+        } else if (route->id == DEBUG_TRACE_R) {
+            if (!get_query_ul(&query, "seconds", &trace_seconds)) {
+                trace_seconds = TRACE_DEFAULT_SECONDS;
+            }
+
+            if (trace_export(&response_body, trace_seconds) != 0) {
+                string_buffer_free(&response_body);
+                return 1;
+            }
+        } else if (route->id == LOAD_HISTORY_R) {
+            // The last hour by minutes by default
+            if (!get_query_ul(&query, "to", &history_to)) {
+                history_to = (unsigned long) time(NULL) + 1;
+            }
+            if (!get_query_ul(&query, "from", &history_from)) {
+                history_from = history_to > HISTORY_DEFAULT_RANGE ? history_to - HISTORY_DEFAULT_RANGE : 0;
+            }
+            if (!get_query_ul(&query, "step", &history_step)) {
+                history_step = HISTORY_DEFAULT_STEP;
+            }
+
+            if (history_from >= history_to || history_step == 0) {
+                status_code = 400;
+                sprintf(status_msg, "Bad Request");
+            } else if (history_query(&response_body, history_from, history_to, history_step) != 0) {
+                string_buffer_free(&response_body);
+                return 1;
+            }
+        } else if (route->id == LOAD_SUMMARY_R) {
+            // The last day and its 95th percentile by default
+            if (!get_query_ul(&query, "to", &history_to)) {
+                history_to = (unsigned long) time(NULL) + 1;
+            }
+            if (!get_query_ul(&query, "from", &history_from)) {
+                history_from = history_to > SUMMARY_DEFAULT_RANGE ? history_to - SUMMARY_DEFAULT_RANGE : 0;
+            }
+            if (!get_query_ul(&query, "p", &percentile)) {
+                percentile = SUMMARY_DEFAULT_PERCENTILE;
+            }
+
+            if (history_from >= history_to || percentile > 100) {
+                status_code = 400;
+                sprintf(status_msg, "Bad Request");
+            } else if (history_summary(&response_body, history_from, history_to, (unsigned) percentile) != 0) {
+                string_buffer_free(&response_body);
+                return 1;
+            }
+        } else if (route->id == LISTENERS_R) {
+            if (listener_stats_export(&response_body) != 0) {
+                string_buffer_free(&response_body);
+                return 1;
+            }
         }
     }
 
+    // Unknown length (HEAD request before the first sample) isn't sent at all
+    content_length = cached_body != NULL && !cached_body->loaded && head_only ? -1 : (long) response_body.length;
+
     // Construct response
     get_http_datetime(datetime);
 
-    sprintf(http_response,
-            "HTTP/1.1 %d %s\r\n"
-            "Connection: close\r\n"
-            "Date: %s\r\n"
-            "Server: hinfosvc/1.0\r\n"
-            "Content-Length: %d\r\n"
-            "Content-Type: text/plain\r\n"
-            "\r\n"
-            "%s", status_code, status_msg, datetime, (int)strlen(response_body), response_body);
+    string_buffer_clear(http_response);
+    string_buffer_printf(http_response,
+                         "HTTP/1.1 %d %s\r\n"
+                         "Connection: close\r\n"
+                         "Date: %s\r\n"
+                         "Server: hinfosvc/1.0\r\n", status_code, status_msg, datetime);
+    if (status_code == 204 || status_code == 405) {
+        string_buffer_printf(http_response, "Allow: GET, HEAD, OPTIONS\r\n");
+    }
+    if (cached_body != NULL && cached_body->loaded) {
+        string_buffer_printf(http_response, "ETag: %s\r\n", cached_body->etag);
+    }
+    if (cached_body != NULL) {
+        print_caching_headers(http_response, cached_body);
+    }
+    if (status_code == 200 && route->id == LOAD_STREAM_R) {
+        // Events are sent until the client closes the connection, so there is no length
+        string_buffer_printf(http_response, "Cache-Control: no-cache\r\n");
+        content_length = -1;
+    }
+    // 204 and 304 responses have no body, so their heads don't describe any
+    if (status_code != 204 && status_code != 304) {
+        if (content_length >= 0) {
+            string_buffer_printf(http_response, "Content-Length: %ld\r\n", content_length);
+        }
+        string_buffer_printf(http_response, "Content-Type: %s\r\n", content_type);
+    }
+    string_buffer_printf(http_response, "\r\n");
+
+    // Response to HEAD request is the same as for GET request, just without the body
+    if (!head_only && string_buffer_append(http_response, response_body.data, response_body.length) != 0) {
+        string_buffer_free(&response_body);
+        return 1;
+    }
 
-    return 0;
+    trace_mark(trace, TRACE_BUILD_END);
+
+    string_buffer_free(&response_body);
+    return status_code == 200 && route->id == LOAD_STREAM_R && !head_only ? 3 : 0;
 }
@@ -6,40 +6,259 @@
  *
  * @author Michal Šmahel (xsmahe01)
  */
+#include <stddef.h>
+#include <stdbool.h>
+#include "string-buffer.h"
+#include "trace.h"
+#include "offload.h"
 
 /**
- * Maximum length of the first line of the HTTP request.
- * It is based on supported requests from project assignment
+ * Default maximum length of the first line of the HTTP request (longer lines => 414)
  */
-#define MAX_MSG_LINE_LEN 30
+#define DEFAULT_MAX_REQUEST_LINE 8192
+/**
+ * Default maximum length of the header section of the HTTP request (longer sections => 431)
+ */
+#define DEFAULT_MAX_HEADERS 8192
 /**
  * Maximum length of HTTP' state message (based on the length of the longest HTTP state name)
  */
-#define HTTP_STATE_MSG_LEN 26
+#define HTTP_STATE_MSG_LEN 31
 /**
- * Maximum length of supported HTTP method => strlen("GET")
+ * Maximum length of datetime formatted for HTTP headers => strlen("Tue, 22 Feb 2022 21:22:19 GMT")
  */
-#define HTTP_METHOD_LEN 3
+#define HTTP_DATETIME_LEN 29
 /**
- * Maximum length of HTTP version => strlen("HTTP/1.1")
+ * Sampling interval of static metrics (hostname, CPU name) in seconds
  */
-#define HTTP_VERSION_LEN 8
+#define STATIC_SAMPLE_INTERVAL 3600
 /**
- * Maximum length of supported HTTP URI
+ * Sampling interval of system-wide counters (TCP sockets in TIME_WAIT) in seconds
  */
-#define HTTP_URI_LEN (MAX_MSG_LINE_LEN - HTTP_METHOD_LEN - HTTP_VERSION_LEN)
+#define COUNTER_SAMPLE_INTERVAL 1
 /**
- * Maximum length of datetime formatted for HTTP headers => strlen("Tue, 22 Feb 2022 21:22:19 GMT")
+ * Default sampling interval of CPU load in seconds
  */
-#define HTTP_DATETIME_LEN 29
+#define DEFAULT_LOAD_SAMPLE_INTERVAL 1
+
+/**
+ * Length of ETag of static bodies (16 hex digits of the hash in quotes)
+ */
+#define HTTP_ETAG_LEN 18
+
+/**
+ * Size of the buffer for reading (and dropping) data behind the HTTP head
+ */
+#define INPUT_BUFFER_LEN 1024
+
+/**
+ * Request waiting for the body collected by the offload pool (it is embedded in the connection)
+ */
+struct collect_waiter {
+    // Neighbours in the list of requests waiting for the same collecting (or already woken up)
+    struct collect_waiter *prev, *next;
+    // Head of the list the request is in (NULL => the request doesn't wait)
+    struct collect_waiter **list;
+};
+
+/**
+ * Part of the loaded HTTP head (it isn't null terminated)
+ */
+struct http_view {
+    // The first character of the part
+    const char *data;
+    // Length of the part
+    size_t length;
+};
+
+/**
+ * Parsed first line of the HTTP request (views into the loaded HTTP head)
+ */
+struct http_request_line {
+    // HTTP method
+    struct http_view method;
+    // Request target (path and query string)
+    struct http_view target;
+    // HTTP version
+    struct http_view version;
+};
 
 /**
- * Processes single HTTP request and prepares a response for it
+ * Header fields captured by the parser (slots of the table in the parser)
+ */
+enum header_field {
+    HOST_F,
+    CONNECTION_F,
+    ACCEPT_F,
+    IF_NONE_MATCH_F,
+    ACCEPT_ENCODING_F,
+    // X-Request-Timeout
+    REQUEST_TIMEOUT_F,
+    // Number of captured fields (it is used for other fields too)
+    HEADER_FIELDS_COUNT,
+};
+
+/**
+ * States of the FSM for loading HTTP request
+ */
+enum loading_state {
+    // Processing of the first row
+    FIRST_ROW_S,
+    // Reading of the header name
+    HEADER_S,
+    // Whitespace characters between header name and its value
+    SPACE_S,
+    // Reading of the header value
+    VALUE_S,
+    // The end of the HTTP head (\r) - just for a check
+    END_S,
+};
+
+/**
+ * State of the FSM for loading HTTP request (it can be fed by parts of the request)
+ */
+struct http_parser {
+    // Current state of the FSM
+    enum loading_state state;
+    // Buffer with the HTTP head, data are received directly there (the parser doesn't copy them)
+    const char *head;
+    // Capacity of the buffer
+    size_t head_capacity;
+    // Number of loaded bytes of the HTTP head
+    size_t head_length;
+    // Length of the first line (without the line ending, it is known after the end of the line)
+    size_t line_length;
+    // Length of the header section loaded so far
+    size_t headers_length;
+    // Case-insensitive hash of the header name being read
+    unsigned name_hash;
+    // Offset of the header name being read
+    size_t name_start;
+    // Slot of the header field whose value is being read (HEADER_FIELDS_COUNT => the field isn't captured)
+    enum header_field value_field;
+    // Offset of the value being read
+    size_t value_start;
+    // Values of captured header fields (NULL data => the field isn't in the request, the first occurrence is kept)
+    struct http_view fields[HEADER_FIELDS_COUNT];
+};
+
+/**
+ * Sets limits of HTTP requests (they must be set before loading of the first request)
+ *
+ * @param max_request_line Maximum length of the first line of the request
+ * @param max_headers Maximum length of the header section of the request
+ */
+void set_http_limits(size_t max_request_line, size_t max_headers);
+
+/**
+ * Returns the capacity of the buffer needed for the HTTP head (the limits are always exceeded before it is full)
+ *
+ * @return Capacity of the buffer (in bytes)
+ */
+size_t http_head_capacity(void);
+
+/**
+ * Prepares the parser for loading a new HTTP request
+ *
+ * @param parser Parser to init
+ * @param head Buffer where the HTTP head is received
+ * @param capacity Capacity of the buffer
+ */
+void http_parser_init(struct http_parser *parser, const char *head, size_t capacity);
+
+/**
+ * Feeds the FSM for loading HTTP request with the next part of the request
+ *
+ * The part must already be stored in the buffer of the parser right after the previously loaded data.
+ *
+ * @param parser Parser state (from the previous calls)
+ * @param length Length of the next part of the HTTP request
+ * @param consumed Pointer to the place where to save number of used bytes (the rest belongs to the next request)
+ * @return 0 => the whole HTTP head has been loaded, 2 => bad HTTP format, 3 => more data needed,
+ *         4 => the first line is too long, 5 => the header section is too long
+ */
+int http_parser_feed(struct http_parser *parser, size_t length, size_t *consumed);
+
+/**
+ * Parses the first line of HTTP request
+ *
+ * @param line The first line of the HTTP request (without the line ending)
+ * @param length Length of the line
+ * @param request Pointer to the place where to save views of the parsed items
+ * @return Error code (equals to HTTP error code number --> 200 => success, etc.)
+ */
+unsigned parse_http_request(const char *line, size_t length, struct http_request_line *request);
+
+/**
+ * Loads and parses the HTTP request stored in memory (no socket is needed)
+ *
+ * @param data Complete HTTP request (the head at least)
+ * @param length Length of the data
+ * @param request Pointer to the place where to save views of the parsed items (they point to the data)
+ * @return Error code (equals to HTTP error code number --> 200 => success, etc.)
+ */
+unsigned parse_http_message(const char *data, size_t length, struct http_request_line *request);
+
+/**
+ * Sets sampling interval of CPU load, responses of /load can be cached for this time
+ *
+ * @param seconds Sampling interval (in seconds)
+ */
+void set_load_sample_interval(unsigned seconds);
+
+/**
+ * Prepares the route table and loads bodies of static routes in advance,
+ * so even the first HEAD request has all the headers
  *
- * @param conn_socket Identifier of the socket used for loading HTTP request
- * @param http_response Buffer where to save complete HTTP response
  * @return 0 => success, 1 => error
  */
-int process_http_request(int conn_socket, char *http_response);
+int init_routes(void);
+
+/**
+ * Inits caches of the calling thread (worker) by bodies loaded by init_routes()
+ *
+ * @param completions Completions of the worker for bodies collected by the offload pool (NULL => collectors
+ *                    are called by the worker)
+ */
+void init_thread_caches(struct offload_completions *completions);
+
+/**
+ * Takes the next request whose body has been collected by the offload pool (see offload_complete())
+ *
+ * @return Woken up request or NULL if there is none
+ */
+struct collect_waiter *take_collected_waiter(void);
+
+/**
+ * Stops waiting of the request for the collected body (the request is aborted)
+ *
+ * @param waiter Request to remove (removing of a request that doesn't wait does nothing)
+ */
+void collect_waiter_remove(struct collect_waiter *waiter);
+
+/**
+ * Formats an event of CPU load stream (text/event-stream) if there is a new sample
+ *
+ * @param output Buffer where to append the event
+ * @param last_sequence Sequential number of the last sent sample (it is updated)
+ * @return 0 => event has been formatted, 1 => no new sample is available
+ */
+int format_load_event(struct string_buffer *output, unsigned long long *last_sequence);
+
+/**
+ * Processes single loaded HTTP request and prepares a response for it
+ *
+ * @param parser Parser the HTTP request has been loaded by
+ * @param loading_result Result of loading the request (0 => success, 2 => bad HTTP format)
+ * @param http_response Buffer where to save complete HTTP response
+ * @param trace Trace record of the request
+ * @param waiter Waiting of the request for the collected body (it waits when 4 is returned)
+ * @return 0 => success, 1 => error, 2 => no sample of CPU load is available yet (process it again after
+ *         the next sample), 3 => the response is the head of CPU load event stream (connection stays open),
+ *         4 => the body is being collected by the offload pool (process it again when the waiter is taken
+ *         by take_collected_waiter())
+ */
+int process_http_request(const struct http_parser *parser, int loading_result, struct string_buffer *http_response,
+                         struct trace_record *trace, struct collect_waiter *waiter);
 
 #endif //HINFOSVC_PROCESSING_H
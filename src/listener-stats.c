@@ -0,0 +1,84 @@
+/**
+ * @file listener-stats.c
+ * Statistics of listen endpoints
+ *
+ * Endpoints are registered at start, so the table never changes while requests are served.
+ * Counters are updated atomically, so they could be shared by more event loops.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <string.h>
+#include "listener-stats.h"
+
+/**
+ * Statistics of all registered endpoints
+ */
+static struct listener_stats listeners[MAX_LISTENERS];
+/**
+ * Number of registered endpoints
+ */
+static unsigned listeners_count = 0;
+
+/**
+ * Registers statistics of a new listen endpoint
+ *
+ * @param name Name of the endpoint
+ * @return Statistics of the endpoint or NULL if there are too many endpoints
+ */
+struct listener_stats *listener_stats_register(const char *name) {
+    struct listener_stats *stats;
+
+    if (listeners_count >= MAX_LISTENERS) {
+        return NULL;
+    }
+
+    stats = &listeners[listeners_count++];
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->name, sizeof(stats->name), "%s", name);
+
+    return stats;
+}
+
+/**
+ * Increments the counter
+ *
+ * @param counter Counter to increment
+ */
+void listener_stats_increment(unsigned long long *counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Decrements the counter
+ *
+ * @param counter Counter to decrement
+ */
+void listener_stats_decrement(unsigned long long *counter) {
+    __atomic_fetch_sub(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Writes statistics of all endpoints to the output
+ *
+ * There is one line per endpoint: "NAME ACCEPTED REJECTED ACTIVE REQUESTS SHED ACTIVE_CLOSES PASSIVE_CLOSES".
+ *
+ * @param output Buffer to append the lines to
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int listener_stats_export(struct string_buffer *output) {
+    for (unsigned i = 0; i < listeners_count; i++) {
+        if (string_buffer_printf(output, "%s %llu %llu %llu %llu %llu %llu %llu\r\n", listeners[i].name,
+                                 __atomic_load_n(&listeners[i].accepted, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].rejected, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].active, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].requests, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].shed, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].active_closes, __ATOMIC_RELAXED),
+                                 __atomic_load_n(&listeners[i].passive_closes, __ATOMIC_RELAXED)) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
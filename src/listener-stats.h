@@ -0,0 +1,74 @@
+#ifndef HINFOSVC_LISTENER_STATS_H
+#define HINFOSVC_LISTENER_STATS_H
+/**
+ * @file listener-stats.h
+ * Header of statistics of listen endpoints
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include "string-buffer.h"
+
+/**
+ * Maximum number of listen endpoints (welcome sockets)
+ */
+#define MAX_LISTENERS 8
+/**
+ * Maximum length of the name of the listen endpoint
+ */
+#define LISTENER_NAME_LEN 115
+
+/**
+ * Statistics of one listen endpoint (counters are updated atomically)
+ */
+struct listener_stats {
+    // Name of the endpoint (as it has been specified)
+    char name[LISTENER_NAME_LEN + 1];
+    // Number of accepted connections
+    unsigned long long accepted;
+    // Number of connections rejected by rate limiting
+    unsigned long long rejected;
+    // Number of connections and requests shed by admission control (503)
+    unsigned long long shed;
+    // Number of currently open connections
+    unsigned long long active;
+    // Number of responded requests
+    unsigned long long requests;
+    // Number of connections closed by the server first (the server keeps their TIME_WAIT)
+    unsigned long long active_closes;
+    // Number of connections closed by the client first (the client keeps their TIME_WAIT)
+    unsigned long long passive_closes;
+};
+
+/**
+ * Registers statistics of a new listen endpoint
+ *
+ * @param name Name of the endpoint
+ * @return Statistics of the endpoint or NULL if there are too many endpoints
+ */
+struct listener_stats *listener_stats_register(const char *name);
+
+/**
+ * Increments the counter
+ *
+ * @param counter Counter to increment
+ */
+void listener_stats_increment(unsigned long long *counter);
+
+/**
+ * Decrements the counter
+ *
+ * @param counter Counter to decrement
+ */
+void listener_stats_decrement(unsigned long long *counter);
+
+/**
+ * Writes statistics of all endpoints to the output
+ *
+ * There is one line per endpoint: "NAME ACCEPTED REJECTED ACTIVE REQUESTS SHED ACTIVE_CLOSES PASSIVE_CLOSES".
+ *
+ * @param output Buffer to append the lines to
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int listener_stats_export(struct string_buffer *output);
+
+#endif //HINFOSVC_LISTENER_STATS_H
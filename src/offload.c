@@ -0,0 +1,305 @@
+/**
+ * @file offload.c
+ * Offload pool (blocking work done outside of event loops)
+ *
+ * Collectors reading files or running commands block the thread calling them. Event loops submit such work
+ * to the pool, so a slow read delays just the requests needing its result, not all connections of the loop.
+ *
+ * Each thread of the pool has its own queue, jobs are submitted to the queues in turn. A thread takes jobs
+ * from its own queue first and steals them from queues of other threads when its queue is empty, so a thread
+ * stuck in a slow job doesn't hold the jobs queued behind it. Finished jobs are posted back to their owner
+ * (event loop) and the owner is woken up by its event file descriptor.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "offload.h"
+
+/**
+ * Queue of jobs of one thread of the pool
+ */
+struct offload_queue {
+    // Lock of the queue
+    pthread_mutex_t lock;
+    // The first (the oldest) and the last job of the queue
+    struct offload_job *head, *tail;
+};
+
+/**
+ * Threads of the pool
+ */
+static pthread_t threads[MAX_OFFLOAD_THREADS];
+/**
+ * Queues of the threads (indexed the same way as the threads)
+ */
+static struct offload_queue queues[MAX_OFFLOAD_THREADS];
+/**
+ * Number of running threads
+ */
+static unsigned threads_count = 0;
+/**
+ * Queue the next job is submitted to (in turn)
+ */
+static unsigned next_queue = 0;
+/**
+ * Lock of the counter of queued jobs (and of stopping of the pool)
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Condition used for waking up idle threads (a job has been queued or the pool is stopping)
+ */
+static pthread_cond_t work_queued = PTHREAD_COND_INITIALIZER;
+/**
+ * Number of queued jobs not claimed by any thread yet
+ */
+static unsigned queued = 0;
+/**
+ * Has been stopping of the pool requested?
+ */
+static bool stop_requested = false;
+
+/**
+ * Takes the oldest job of the queue
+ *
+ * @param queue Queue to take the job from
+ * @return Taken job or NULL if the queue is empty
+ */
+struct offload_job *offload_queue_pop(struct offload_queue *queue) {
+    struct offload_job *job;
+
+    pthread_mutex_lock(&queue->lock);
+    if ((job = queue->head) != NULL) {
+        queue->head = job->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+/**
+ * Posts the finished job to its owner
+ *
+ * @param job Finished job
+ */
+void offload_post(struct offload_job *job) {
+    struct offload_completions *completions = job->completions;
+    uint64_t increment = 1;
+
+    pthread_mutex_lock(&completions->lock);
+    job->next = completions->finished;
+    completions->finished = job;
+    pthread_mutex_unlock(&completions->lock);
+
+    if (write(completions->fd, &increment, sizeof(increment)) == -1) {
+        fprintf(stderr, "Cannot notify owner of offloaded job\n");
+    }
+}
+
+/**
+ * Main function of the thread of the pool
+ *
+ * @param arg Index of the thread (its queue)
+ * @return Always NULL
+ */
+void *offload_run(void *arg) {
+    unsigned index = (unsigned) (uintptr_t) arg;
+    struct offload_job *job;
+
+    while (true) {
+        // A job is claimed first, so it is certainly in some queue (jobs are counted after queueing)
+        pthread_mutex_lock(&lock);
+        while (queued == 0 && !stop_requested) {
+            pthread_cond_wait(&work_queued, &lock);
+        }
+        if (queued == 0) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        queued--;
+        pthread_mutex_unlock(&lock);
+
+        // Own queue first, then the queues of other threads (stealing)
+        job = NULL;
+        for (unsigned i = 0; job == NULL; i = (i + 1) % threads_count) {
+            job = offload_queue_pop(&queues[(index + i) % threads_count]);
+        }
+
+        job->work(job);
+        offload_post(job);
+    }
+}
+
+/**
+ * Starts threads of the offload pool
+ *
+ * @param count Number of threads (0 => no pool, offload_submit() always fails)
+ * @return 0 => success, 1 => error
+ */
+int offload_start(unsigned count) {
+    stop_requested = false;
+
+    for (threads_count = 0; threads_count < count; threads_count++) {
+        pthread_mutex_init(&queues[threads_count].lock, NULL);
+        queues[threads_count].head = NULL;
+        queues[threads_count].tail = NULL;
+
+        if (pthread_create(&threads[threads_count], NULL, offload_run, (void *) (uintptr_t) threads_count) != 0) {
+            fprintf(stderr, "Cannot start thread of offload pool\n");
+            pthread_mutex_destroy(&queues[threads_count].lock);
+            offload_stop();
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Stops threads of the offload pool (queued jobs are finished first)
+ */
+void offload_stop(void) {
+    pthread_mutex_lock(&lock);
+    stop_requested = true;
+    pthread_cond_broadcast(&work_queued);
+    pthread_mutex_unlock(&lock);
+
+    for (unsigned i = 0; i < threads_count; i++) {
+        pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&queues[i].lock);
+    }
+    threads_count = 0;
+}
+
+/**
+ * Inits completions of the owner
+ *
+ * @param completions Completions to init
+ * @return 0 => success, 1 => error
+ */
+int offload_completions_init(struct offload_completions *completions) {
+    if ((completions->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        fprintf(stderr, "Cannot create offload notification file descriptor\n");
+        return 1;
+    }
+
+    pthread_mutex_init(&completions->lock, NULL);
+    completions->finished = NULL;
+    completions->pending = 0;
+
+    return 0;
+}
+
+/**
+ * Releases completions of the owner
+ *
+ * @param completions Completions to release
+ * @pre No job of the owner is pending (see offload_wait())
+ */
+void offload_completions_free(struct offload_completions *completions) {
+    pthread_mutex_destroy(&completions->lock);
+    close(completions->fd);
+}
+
+/**
+ * Submits the job to the offload pool
+ *
+ * @param job Job to submit (work and complete must be set)
+ * @param completions Completions of the owner (the caller)
+ * @return 0 => success, 1 => error (there is no pool, the work must be done by the caller)
+ */
+int offload_submit(struct offload_job *job, struct offload_completions *completions) {
+    struct offload_queue *queue;
+
+    if (threads_count == 0 || completions == NULL) {
+        return 1;
+    }
+
+    job->completions = completions;
+    job->next = NULL;
+    completions->pending++;
+
+    queue = &queues[__atomic_fetch_add(&next_queue, 1, __ATOMIC_RELAXED) % threads_count];
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail != NULL) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
+    }
+    queue->tail = job;
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_mutex_lock(&lock);
+    queued++;
+    pthread_cond_signal(&work_queued);
+    pthread_mutex_unlock(&lock);
+
+    return 0;
+}
+
+/**
+ * Takes all finished jobs of the owner
+ *
+ * @param completions Completions of the owner
+ * @return List of finished jobs (linked by next)
+ */
+struct offload_job *offload_take(struct offload_completions *completions) {
+    struct offload_job *finished;
+    uint64_t counter;
+
+    // Reset the notification counter (jobs finished after the reset notify again)
+    if (read(completions->fd, &counter, sizeof(counter)) == -1) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&completions->lock);
+    finished = completions->finished;
+    completions->finished = NULL;
+    pthread_mutex_unlock(&completions->lock);
+
+    return finished;
+}
+
+/**
+ * Handles finished jobs of the owner (their complete functions are called)
+ *
+ * @param completions Completions of the owner (the caller)
+ */
+void offload_complete(struct offload_completions *completions) {
+    struct offload_job *job = offload_take(completions);
+    struct offload_job *next;
+
+    while (job != NULL) {
+        // The job can be submitted again by its completion
+        next = job->next;
+        completions->pending--;
+        job->complete(job);
+        job = next;
+    }
+}
+
+/**
+ * Waits until all jobs of the owner are finished (their completions aren't handled)
+ *
+ * @param completions Completions of the owner (the caller)
+ */
+void offload_wait(struct offload_completions *completions) {
+    struct pollfd notification = {.fd = completions->fd, .events = POLLIN};
+
+    while (completions->pending > 0) {
+        if (poll(&notification, 1, -1) == -1) {
+            continue;
+        }
+
+        for (struct offload_job *job = offload_take(completions); job != NULL; job = job->next) {
+            completions->pending--;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef HINFOSVC_OFFLOAD_H
+#define HINFOSVC_OFFLOAD_H
+/**
+ * @file offload.h
+ * Header of the offload pool (blocking work done outside of event loops)
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <pthread.h>
+
+/**
+ * Default number of threads of the offload pool
+ */
+#define DEFAULT_OFFLOAD_THREADS 2
+/**
+ * Maximum number of threads of the offload pool
+ */
+#define MAX_OFFLOAD_THREADS 16
+
+struct offload_completions;
+
+/**
+ * Job of the offload pool (it is embedded in a bigger structure with the arguments and results of the work)
+ */
+struct offload_job {
+    // Blocking work (it runs in a thread of the pool)
+    void (*work)(struct offload_job *job);
+    // Handling of the result (it runs in the owner of the completions after the work)
+    void (*complete)(struct offload_job *job);
+    // Completions of the owner the finished job is posted to
+    struct offload_completions *completions;
+    // Next job in the queue or in the list of finished jobs
+    struct offload_job *next;
+};
+
+/**
+ * Finished jobs of one owner (event loop), the owner is notified by the event file descriptor
+ */
+struct offload_completions {
+    // Event file descriptor (eventfd) watched by the owner
+    int fd;
+    // Lock of the list of finished jobs
+    pthread_mutex_t lock;
+    // Finished jobs not taken by the owner yet
+    struct offload_job *finished;
+    // Number of submitted jobs whose completion hasn't been handled yet (used just by the owner)
+    unsigned pending;
+};
+
+/**
+ * Starts threads of the offload pool
+ *
+ * @param count Number of threads (0 => no pool, offload_submit() always fails)
+ * @return 0 => success, 1 => error
+ */
+int offload_start(unsigned count);
+
+/**
+ * Stops threads of the offload pool (queued jobs are finished first)
+ */
+void offload_stop(void);
+
+/**
+ * Inits completions of the owner
+ *
+ * @param completions Completions to init
+ * @return 0 => success, 1 => error
+ */
+int offload_completions_init(struct offload_completions *completions);
+
+/**
+ * Releases completions of the owner
+ *
+ * @param completions Completions to release
+ * @pre No job of the owner is pending (see offload_wait())
+ */
+void offload_completions_free(struct offload_completions *completions);
+
+/**
+ * Submits the job to the offload pool
+ *
+ * @param job Job to submit (work and complete must be set)
+ * @param completions Completions of the owner (the caller)
+ * @return 0 => success, 1 => error (there is no pool, the work must be done by the caller)
+ */
+int offload_submit(struct offload_job *job, struct offload_completions *completions);
+
+/**
+ * Handles finished jobs of the owner (their complete functions are called)
+ *
+ * @param completions Completions of the owner (the caller)
+ */
+void offload_complete(struct offload_completions *completions);
+
+/**
+ * Waits until all jobs of the owner are finished (their completions aren't handled)
+ *
+ * @param completions Completions of the owner (the caller)
+ */
+void offload_wait(struct offload_completions *completions);
+
+#endif //HINFOSVC_OFFLOAD_H
@@ -0,0 +1,306 @@
+/**
+ * @file rate-limit.c
+ * Per-client rate limiting (token buckets keyed by peer address)
+ *
+ * Buckets live in a fixed pool, they are found by a small hash table of 16-bit indexes (open addressing
+ * with linear probing). When the pool is full, the least recently seen client is evicted. The check
+ * is a hash, a few probes and an update of the bucket, so it is done for every accepted connection.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "rate-limit.h"
+
+_Static_assert(RATE_LIMIT_SLOTS >= 2 * RATE_LIMIT_CLIENTS, "RATE_LIMIT_SLOTS must be at least twice RATE_LIMIT_CLIENTS");
+_Static_assert((RATE_LIMIT_SLOTS & (RATE_LIMIT_SLOTS - 1)) == 0, "RATE_LIMIT_SLOTS must be a power of 2");
+_Static_assert(RATE_LIMIT_CLIENTS < UINT16_MAX, "Indexes of entries must fit into 16 bits");
+
+/**
+ * Marker of no entry in the LRU list
+ */
+#define NO_ENTRY RATE_LIMIT_CLIENTS
+
+/**
+ * Returns current time of the monotonic clock (the coarse one is precise enough and cheaper)
+ *
+ * @return Current time in milliseconds
+ */
+uint64_t rate_limit_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * Computes hash of the address
+ *
+ * @param address IPv6 address
+ * @return Hash of the address
+ */
+uint32_t rate_limit_hash(const uint8_t *address) {
+    uint64_t high, low;
+
+    memcpy(&high, address, sizeof(high));
+    memcpy(&low, &address[8], sizeof(low));
+
+    // Multiplicative hashing, the upper bits are mixed the most
+    return (uint32_t) (((high * 0x9e3779b97f4a7c15u) ^ low) * 0xff51afd7ed558ccdu >> 32);
+}
+
+/**
+ * Inits the rate limiter
+ *
+ * @param limiter Rate limiter to init
+ * @param rate Number of requests per second allowed for one client address (0 => no limiting)
+ * @param burst Number of requests allowed at once (capacity of the bucket)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int rate_limiter_init(struct rate_limiter *limiter, unsigned rate, unsigned burst) {
+    memset(limiter, 0, sizeof(*limiter));
+    limiter->enabled = rate > 0;
+    limiter->rate = rate;
+    limiter->burst = burst > 0 ? burst : 1;
+    limiter->lru_head = NO_ENTRY;
+    limiter->lru_tail = NO_ENTRY;
+
+    if (!limiter->enabled) {
+        return 0;
+    }
+
+    if ((limiter->slots = calloc(RATE_LIMIT_SLOTS, sizeof(*limiter->slots))) == NULL
+        || (limiter->entries = calloc(RATE_LIMIT_CLIENTS, sizeof(*limiter->entries))) == NULL) {
+        fprintf(stderr, "Cannot allocate memory for rate limiter\n");
+        free(limiter->slots);
+        limiter->slots = NULL;
+        limiter->enabled = false;
+        return 1;
+    }
+    pthread_mutex_init(&limiter->lock, NULL);
+
+    // The response doesn't depend on the request, so it is prepared just once
+    // (the rate is at least 1 per second, so the next token comes within a second)
+    limiter->response_length = (size_t) snprintf(limiter->response, sizeof(limiter->response),
+                                                 "HTTP/1.1 429 Too Many Requests\r\n"
+                                                 "Connection: close\r\n"
+                                                 "Server: hinfosvc/1.0\r\n"
+                                                 "Retry-After: 1\r\n"
+                                                 "Content-Length: 0\r\n"
+                                                 "\r\n");
+
+    return 0;
+}
+
+/**
+ * Removes the entry from the LRU list
+ *
+ * @param limiter Rate limiter
+ * @param index Index of the entry
+ */
+void lru_unlink(struct rate_limiter *limiter, uint16_t index) {
+    struct rate_limit_entry *entry = &limiter->entries[index];
+
+    if (entry->prev != NO_ENTRY) {
+        limiter->entries[entry->prev].next = entry->next;
+    } else {
+        limiter->lru_head = entry->next;
+    }
+    if (entry->next != NO_ENTRY) {
+        limiter->entries[entry->next].prev = entry->prev;
+    } else {
+        limiter->lru_tail = entry->prev;
+    }
+}
+
+/**
+ * Inserts the entry to the beginning of the LRU list (the most recently seen entry)
+ *
+ * @param limiter Rate limiter
+ * @param index Index of the entry
+ */
+void lru_push(struct rate_limiter *limiter, uint16_t index) {
+    struct rate_limit_entry *entry = &limiter->entries[index];
+
+    entry->prev = NO_ENTRY;
+    entry->next = limiter->lru_head;
+    if (limiter->lru_head != NO_ENTRY) {
+        limiter->entries[limiter->lru_head].prev = index;
+    } else {
+        limiter->lru_tail = index;
+    }
+    limiter->lru_head = index;
+}
+
+/**
+ * Finds the slot of the address (or the empty slot where the address belongs)
+ *
+ * @param limiter Rate limiter
+ * @param address IPv6 address
+ * @param hash Hash of the address
+ * @return Index of the slot
+ */
+unsigned find_slot(const struct rate_limiter *limiter, const uint8_t *address, uint32_t hash) {
+    unsigned slot = hash & (RATE_LIMIT_SLOTS - 1);
+    const struct rate_limit_entry *entry;
+
+    while (limiter->slots[slot] != 0) {
+        entry = &limiter->entries[limiter->slots[slot] - 1];
+        if (entry->hash == hash && memcmp(entry->address, address, sizeof(entry->address)) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (RATE_LIMIT_SLOTS - 1);
+    }
+
+    return slot;
+}
+
+/**
+ * Removes the slot from the hash table (following slots are shifted back, so no tombstones are needed)
+ *
+ * @param limiter Rate limiter
+ * @param slot Index of the slot to remove
+ */
+void remove_slot(struct rate_limiter *limiter, unsigned slot) {
+    unsigned next = slot;
+    unsigned home;
+
+    while (true) {
+        next = (next + 1) & (RATE_LIMIT_SLOTS - 1);
+        if (limiter->slots[next] == 0) {
+            break;
+        }
+
+        // Entry can be moved to the hole only if the hole is between its home slot and its current slot
+        home = limiter->entries[limiter->slots[next] - 1].hash & (RATE_LIMIT_SLOTS - 1);
+        if (((next - home) & (RATE_LIMIT_SLOTS - 1)) >= ((next - slot) & (RATE_LIMIT_SLOTS - 1))) {
+            limiter->slots[slot] = limiter->slots[next];
+            slot = next;
+        }
+    }
+
+    limiter->slots[slot] = 0;
+}
+
+/**
+ * Converts the socket address to IPv6 address (IPv4 addresses are mapped)
+ *
+ * @param address Socket address
+ * @param length Length of the socket address
+ * @param ipv6 Pointer to the place where to save the IPv6 address
+ * @return Is the address an IP address?
+ */
+bool to_ipv6_address(const struct sockaddr *address, socklen_t length, uint8_t *ipv6) {
+    if (address->sa_family == AF_INET6 && length >= sizeof(struct sockaddr_in6)) {
+        memcpy(ipv6, &((const struct sockaddr_in6 *) address)->sin6_addr, 16);
+        return true;
+    }
+    if (address->sa_family == AF_INET && length >= sizeof(struct sockaddr_in)) {
+        memset(ipv6, 0, 10);
+        memset(&ipv6[10], 0xff, 2);
+        memcpy(&ipv6[12], &((const struct sockaddr_in *) address)->sin_addr, 4);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Takes one token from the bucket of the address (the lock of the limiter must be held)
+ *
+ * @param limiter Rate limiter
+ * @param ipv6 IPv6 address of the client
+ * @return Has the bucket had a token?
+ */
+bool rate_limiter_take(struct rate_limiter *limiter, const uint8_t *ipv6) {
+    struct rate_limit_entry *entry;
+    uint64_t now;
+    uint64_t tokens;
+    uint32_t hash;
+    unsigned slot;
+    uint16_t index;
+
+    now = rate_limit_time_ms();
+    hash = rate_limit_hash(ipv6);
+    slot = find_slot(limiter, ipv6, hash);
+
+    if (limiter->slots[slot] != 0) {
+        index = (uint16_t) (limiter->slots[slot] - 1);
+        lru_unlink(limiter, index);
+    } else {
+        // New client gets a full bucket, the least recently seen one is forgotten if there is no space
+        if (limiter->entries_count < RATE_LIMIT_CLIENTS) {
+            index = (uint16_t) limiter->entries_count++;
+        } else {
+            index = limiter->lru_tail;
+            lru_unlink(limiter, index);
+            remove_slot(limiter, find_slot(limiter, limiter->entries[index].address, limiter->entries[index].hash));
+            // Removal could shift the slots, so the place for the new client must be found again
+            slot = find_slot(limiter, ipv6, hash);
+        }
+
+        entry = &limiter->entries[index];
+        memcpy(entry->address, ipv6, sizeof(entry->address));
+        entry->hash = hash;
+        entry->tokens = limiter->burst * 1000;
+        entry->updated_at = now;
+        limiter->slots[slot] = (uint16_t) (index + 1);
+    }
+    lru_push(limiter, index);
+
+    // Refill the bucket by the elapsed time
+    entry = &limiter->entries[index];
+    tokens = entry->tokens + (now - entry->updated_at) * limiter->rate;
+    entry->tokens = (uint32_t) (tokens < limiter->burst * 1000ULL ? tokens : limiter->burst * 1000ULL);
+    entry->updated_at = now;
+
+    if (entry->tokens < 1000) {
+        return false;
+    }
+
+    entry->tokens -= 1000;
+    return true;
+}
+
+/**
+ * Takes one token from the bucket of the client address
+ *
+ * @param limiter Rate limiter
+ * @param address Address of the client (from accept())
+ * @param length Length of the address
+ * @return Is the client allowed to send the request? (clients of UNIX sockets are always allowed)
+ */
+bool rate_limiter_allow(struct rate_limiter *limiter, const struct sockaddr *address, socklen_t length) {
+    uint8_t ipv6[16];
+    bool allowed;
+
+    if (!limiter->enabled || !to_ipv6_address(address, length, ipv6)) {
+        return true;
+    }
+
+    pthread_mutex_lock(&limiter->lock);
+    allowed = rate_limiter_take(limiter, ipv6);
+    pthread_mutex_unlock(&limiter->lock);
+
+    return allowed;
+}
+
+/**
+ * Releases resources of the rate limiter
+ *
+ * @param limiter Rate limiter to free
+ */
+void rate_limiter_free(struct rate_limiter *limiter) {
+    if (limiter->enabled) {
+        pthread_mutex_destroy(&limiter->lock);
+    }
+    free(limiter->slots);
+    free(limiter->entries);
+    limiter->slots = NULL;
+    limiter->entries = NULL;
+    limiter->enabled = false;
+}
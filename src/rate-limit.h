@@ -0,0 +1,97 @@
+#ifndef HINFOSVC_RATE_LIMIT_H
+#define HINFOSVC_RATE_LIMIT_H
+/**
+ * @file rate-limit.h
+ * Header of per-client rate limiting (token buckets keyed by peer address)
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/**
+ * Maximum number of tracked client addresses (the least recently seen one is evicted then)
+ */
+#define RATE_LIMIT_CLIENTS 2048
+/**
+ * Number of slots of the hash table (power of 2, the table is at most half full)
+ */
+#define RATE_LIMIT_SLOTS 4096
+/**
+ * Maximum length of the precomputed 429 response
+ */
+#define RATE_LIMIT_RESPONSE_LEN 160
+
+/**
+ * Token bucket of one client address
+ */
+struct rate_limit_entry {
+    // IPv6 address of the client (IPv4 addresses are mapped to IPv6)
+    uint8_t address[16];
+    // Time of the last update of the bucket (monotonic time in milliseconds)
+    uint64_t updated_at;
+    // Number of tokens in the bucket (in thousandths of a token)
+    uint32_t tokens;
+    // Hash of the address
+    uint32_t hash;
+    // Neighbours in the LRU list (indexes of entries, RATE_LIMIT_CLIENTS => no neighbour)
+    uint16_t prev, next;
+};
+
+/**
+ * Rate limiter (it is shared by all event loops, so a client gets the same rate whichever worker accepts it)
+ */
+struct rate_limiter {
+    // Is the rate limiting turned on?
+    bool enabled;
+    // Lock of the buckets (a check is just a few probes, so the lock is held very briefly)
+    pthread_mutex_t lock;
+    // Number of tokens added per second
+    unsigned rate;
+    // Capacity of buckets (in tokens)
+    unsigned burst;
+    // Hash table (open addressing with linear probing), index of the entry + 1 (0 => empty slot)
+    uint16_t *slots;
+    // Pool of buckets
+    struct rate_limit_entry *entries;
+    // Number of used entries of the pool
+    unsigned entries_count;
+    // The most and the least recently seen entry (RATE_LIMIT_CLIENTS => empty list)
+    uint16_t lru_head, lru_tail;
+    // Precomputed response for clients over the limit
+    char response[RATE_LIMIT_RESPONSE_LEN + 1];
+    // Length of the precomputed response
+    size_t response_length;
+};
+
+/**
+ * Inits the rate limiter
+ *
+ * @param limiter Rate limiter to init
+ * @param rate Number of requests per second allowed for one client address (0 => no limiting)
+ * @param burst Number of requests allowed at once (capacity of the bucket)
+ * @return 0 => success, 1 => error (memory allocation failed)
+ */
+int rate_limiter_init(struct rate_limiter *limiter, unsigned rate, unsigned burst);
+
+/**
+ * Takes one token from the bucket of the client address
+ *
+ * @param limiter Rate limiter
+ * @param address Address of the client (from accept())
+ * @param length Length of the address
+ * @return Is the client allowed to send the request? (clients of UNIX sockets are always allowed)
+ */
+bool rate_limiter_allow(struct rate_limiter *limiter, const struct sockaddr *address, socklen_t length);
+
+/**
+ * Releases resources of the rate limiter
+ *
+ * @param limiter Rate limiter to free
+ */
+void rate_limiter_free(struct rate_limiter *limiter);
+
+#endif //HINFOSVC_RATE_LIMIT_H
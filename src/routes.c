@@ -0,0 +1,116 @@
+/**
+ * @file routes.c
+ * Route table and URI dispatching
+ *
+ * Paths from the route table are placed into a small hash table. The seed of the hash function
+ * is chosen during initialization, so no two routes share a slot. Dispatching is then one hash
+ * computation and one comparison of the path, no matter how many routes are registered.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "routes.h"
+
+/**
+ * Maximum number of tried seeds of the hash function
+ */
+#define MAX_SEED_ATTEMPTS 1000000
+
+_Static_assert(ROUTE_SLOTS >= 2 * ROUTES_COUNT, "ROUTE_SLOTS must be at least twice the number of routes");
+_Static_assert((ROUTE_SLOTS & (ROUTE_SLOTS - 1)) == 0, "ROUTE_SLOTS must be a power of 2");
+
+/**
+ * Table of all routes (indexed by route identifiers)
+ */
+const struct route routes[ROUTES_COUNT] = {
+#define ROUTE_ENTRY(id, path, content_type, cacheable, collector, blocking, body_length) \
+    [id] = {id, path, sizeof(path) - 1, content_type, cacheable, collector, #collector, blocking, body_length},
+        ROUTE_TABLE(ROUTE_ENTRY)
+#undef ROUTE_ENTRY
+};
+
+/**
+ * Hash table with routes (NULL => empty slot)
+ */
+static const struct route *slots[ROUTE_SLOTS];
+/**
+ * Seed of the hash function giving no collisions
+ */
+static uint32_t hash_seed;
+
+/**
+ * Computes hash of the path (seeded FNV-1a)
+ *
+ * @param path Path to hash
+ * @param length Length of the path
+ * @param seed Seed of the hash function
+ * @return Index of the slot in the hash table
+ */
+unsigned route_slot(const char *path, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) path[i];
+        hash *= 16777619u;
+    }
+
+    // Final mixing, so even the lowest bits depend on all characters
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+
+    return hash & (ROUTE_SLOTS - 1);
+}
+
+/**
+ * Builds collision-free (perfect) hash for dispatching of the route table
+ *
+ * @return 0 => success, 1 => error (no suitable hash seed has been found)
+ */
+int routes_init(void) {
+    unsigned slot;
+    bool collision;
+
+    for (uint32_t seed = 0; seed < MAX_SEED_ATTEMPTS; seed++) {
+        memset(slots, 0, sizeof(slots));
+        collision = false;
+
+        for (int i = 0; i < ROUTES_COUNT && !collision; i++) {
+            slot = route_slot(routes[i].path, routes[i].path_length, seed);
+            if (slots[slot] != NULL) {
+                collision = true;
+            } else {
+                slots[slot] = &routes[i];
+            }
+        }
+
+        if (!collision) {
+            hash_seed = seed;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "Cannot build perfect hash for the route table\n");
+    return 1;
+}
+
+/**
+ * Finds the route for the path (constant time, independent on the number of routes)
+ *
+ * @param path Path part of the HTTP URI
+ * @param length Length of the path
+ * @return Found route or NULL if there is no route for the path
+ * @pre routes_init() has been called
+ */
+const struct route *find_route(const char *path, size_t length) {
+    const struct route *route = slots[route_slot(path, length, hash_seed)];
+
+    // Different paths could have the same hash, so the path must be verified
+    if (route == NULL || route->path_length != length || memcmp(route->path, path, length) != 0) {
+        return NULL;
+    }
+
+    return route;
+}
@@ -0,0 +1,97 @@
+#ifndef HINFOSVC_ROUTES_H
+#define HINFOSVC_ROUTES_H
+/**
+ * @file routes.h
+ * Header of the route table and URI dispatching
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stddef.h>
+#include <stdbool.h>
+#include "system-info.h"
+
+/**
+ * Table of all routes of the server
+ *
+ * ROUTE(identifier, path, content type, is cacheable, collector (NULL => special handling), is the collector
+ *       blocking, maximum body length)
+ *
+ * Cacheable routes are samples of some metric, they get ETag and caching headers. Routes with a collector
+ * are static ones (the collector is called once per STATIC_SAMPLE_INTERVAL, the one of /stats/tcp once per
+ * COUNTER_SAMPLE_INTERVAL), blocking collectors (reading files, running commands) are called by the offload
+ * pool. The maximum body length is used for preallocating the body (0 => unknown, the body grows as needed).
+ */
+#define ROUTE_TABLE(ROUTE) \
+    ROUTE(HOSTNAME_R,     "/hostname",        "text/plain",        true,  get_hostname, true,  HOSTNAME_LENGTH + 2) \
+    ROUTE(CPU_NAME_R,     "/cpu-name",        "text/plain",        true,  get_cpu_info, true,  CPU_INFO_LENGTH + 2) \
+    ROUTE(LOAD_R,         "/load",            "text/plain",        true,  NULL,         false, sizeof("100%\r\n") - 1) \
+    ROUTE(LOAD_STREAM_R,  "/load/stream",     "text/event-stream", false, NULL,         false, 0) \
+    ROUTE(LOAD_HISTORY_R, "/load/history",    "text/plain",        false, NULL,         false, 0) \
+    ROUTE(LOAD_SUMMARY_R, "/load/summary",    "text/plain",        false, NULL,         false, 0) \
+    ROUTE(LISTENERS_R,    "/stats/listeners", "text/plain",        false, NULL,         false, 0) \
+    ROUTE(TCP_STATS_R,    "/stats/tcp",       "text/plain",        true,  get_tcp_info, true,  TCP_INFO_LENGTH + 2) \
+    ROUTE(DEBUG_TRACE_R,  "/debug/trace",     "application/json",  false, NULL,         false, 0)
+
+/**
+ * Identifiers of the routes
+ */
+enum route_id {
+#define ROUTE_ID(id, path, content_type, cacheable, collector, blocking, body_length) id,
+    ROUTE_TABLE(ROUTE_ID)
+#undef ROUTE_ID
+    // Number of routes (not a route)
+    ROUTES_COUNT,
+};
+
+/**
+ * Number of slots of the hash table used for dispatching (power of 2, at least twice the number of routes)
+ */
+#define ROUTE_SLOTS 32
+
+/**
+ * Metadata of the route
+ */
+struct route {
+    // Identifier of the route
+    enum route_id id;
+    // Path of the route
+    const char *path;
+    // Length of the path
+    size_t path_length;
+    // Content type of the response body
+    const char *content_type;
+    // Is the body a sample that could be cached?
+    bool cacheable;
+    // Function for getting data of the static body (NULL => the route has special handling)
+    int (*collector)(char *);
+    // Name of the collector (for tracing)
+    const char *collector_name;
+    // Does the collector block? (it is called by the offload pool then)
+    bool blocking;
+    // Maximum length of the body (0 => unknown)
+    size_t max_body_length;
+};
+
+/**
+ * Table of all routes (indexed by route identifiers)
+ */
+extern const struct route routes[ROUTES_COUNT];
+
+/**
+ * Builds collision-free (perfect) hash for dispatching of the route table
+ *
+ * @return 0 => success, 1 => error (no suitable hash seed has been found)
+ */
+int routes_init(void);
+
+/**
+ * Finds the route for the path (constant time, independent on the number of routes)
+ *
+ * @param path Path part of the HTTP URI
+ * @param length Length of the path
+ * @return Found route or NULL if there is no route for the path
+ * @pre routes_init() has been called
+ */
+const struct route *find_route(const char *path, size_t length);
+
+#endif //HINFOSVC_ROUTES_H
@@ -0,0 +1,502 @@
+/**
+ * @file sampler.c
+ * Background sampler of CPU load
+ *
+ * The sampler thread loads CPU statistics once per sampling interval and publishes
+ * CPU load counted between the last two loadings. Request handlers just read the latest
+ * sample, so they never wait for the measuring.
+ *
+ * Samples are published by a seqlock: the sampler is the only writer, readers (workers) copy
+ * the sample and retry if the generation has changed meanwhile. Readers never write
+ * shared memory, so they don't bounce cache lines among cores.
+ *
+ * Lazy sampler (non-zero idle window) isn't running at start. It is started by the first request
+ * demanding samples and its thread ends when no sample has been demanded for the idle window,
+ * so an idle server has no thread and no timer waking it up.
+ *
+ * Coalescing sampler has no thread at all. Event loops measure CPU load themselves (by a timer)
+ * when requests need a sample and record the result here, a sample is valid for the sampling interval.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#define _GNU_SOURCE // cpu_set_t
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sampler.h"
+#include "history.h"
+#include "affinity.h"
+
+/**
+ * Sampler thread
+ */
+static pthread_t thread;
+/**
+ * Has been the sampler thread started? (it could have already ended, but it hasn't been joined yet)
+ */
+static bool started = false;
+/**
+ * Is the sampler thread taking samples? (it is changed under the lock)
+ */
+static bool running = false;
+/**
+ * Has been stopping of the sampler requested?
+ */
+static bool stop_requested = false;
+/**
+ * Lock for stopping of the sampler (published samples don't use it)
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Condition used for waking up the sampler thread (when it should stop)
+ */
+static pthread_cond_t wake_up = PTHREAD_COND_INITIALIZER;
+/**
+ * Sampling interval (in seconds)
+ */
+static unsigned sampling_interval;
+/**
+ * Event file descriptors to notify after each sample
+ */
+static int notify_event_fds[SAMPLER_MAX_NOTIFY];
+/**
+ * Number of event file descriptors to notify
+ */
+static unsigned notify_event_count = 0;
+/**
+ * Placement of the sampler thread (NULL => the thread isn't pinned)
+ */
+static const struct cpu_affinity *sampler_affinity = NULL;
+/**
+ * Is the sampler coalescing? (samples are recorded by event loops, they expire after the sampling interval)
+ */
+static bool coalescing = false;
+/**
+ * Idle window of lazy sampler (in milliseconds, 0 => the sampler runs all the time)
+ */
+static unsigned long long idle_window_ms = 0;
+/**
+ * Time of the last demand for samples (monotonic time in milliseconds)
+ */
+static unsigned long long last_demand_ms = 0;
+/**
+ * The latest sample taken by the sampler thread (it is used by the thread only)
+ */
+static struct cpu_load_sample latest = {0};
+
+/**
+ * Number of machine words of the sample (it is copied word by word)
+ */
+#define SAMPLE_WORDS (sizeof(struct cpu_load_sample) / sizeof(unsigned long))
+
+_Static_assert(sizeof(struct cpu_load_sample) % sizeof(unsigned long) == 0,
+               "Sample must be copyable word by word");
+
+/**
+ * Sample as machine words (they are copied atomically one by one)
+ */
+union sample_words {
+    struct cpu_load_sample sample;
+    unsigned long words[SAMPLE_WORDS];
+};
+
+/**
+ * The latest published sample (it has its own cache line, so readers don't share it with other variables)
+ */
+static struct {
+    // Generation of the sample (odd => the sample is being written)
+    unsigned long generation;
+    // The sample (sequence == 0 => no sample has been taken yet)
+    union sample_words data;
+} published __attribute__((aligned(64))) = {0};
+
+/**
+ * Returns current Unix time with millisecond precision
+ *
+ * @return Current time in milliseconds
+ */
+unsigned long long sampler_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns current time of the monotonic clock (the coarse one is precise enough for idle windows)
+ *
+ * @return Current time in milliseconds
+ */
+unsigned long long sampler_monotonic_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+}
+
+/**
+ * Waits until the deadline or stop request (whatever comes first)
+ *
+ * @param deadline Time to wait for (monotonic clock)
+ * @return Has been stopping requested?
+ * @pre The lock is held by the caller
+ */
+bool sampler_wait(const struct timespec *deadline) {
+    while (!stop_requested) {
+        if (pthread_cond_timedwait(&wake_up, &lock, deadline) != 0) {
+            // Timeout
+            break;
+        }
+    }
+
+    return stop_requested;
+}
+
+/**
+ * Moves the time by the number of milliseconds
+ *
+ * @param time Time to move
+ * @param ms Number of milliseconds to add
+ */
+void timespec_add_ms(struct timespec *time, unsigned long ms) {
+    time->tv_sec += (time_t) (ms / 1000);
+    time->tv_nsec += (long) (ms % 1000) * 1000000;
+    if (time->tv_nsec >= 1000000000) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * Publishes the sample to readers
+ *
+ * @param sample Sample to publish
+ * @pre Called by the sampler thread only (there is one writer)
+ */
+void sampler_publish(const struct cpu_load_sample *sample) {
+    union sample_words source = {.sample = *sample};
+    unsigned long generation = published.generation;
+
+    // Odd generation tells readers that the sample is incomplete
+    __atomic_store_n(&published.generation, generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < SAMPLE_WORDS; i++) {
+        __atomic_store_n(&published.data.words[i], source.words[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&published.generation, generation + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Records a new sample: publishes it, appends it to the history and notifies event loops
+ *
+ * @param load CPU load in %
+ * @param stats CPU statistics the load was computed from (end of the measuring)
+ * @pre The lock is held by the caller
+ */
+void sampler_record_locked(int load, const struct proc_stats *stats) {
+    uint64_t one = 1;
+
+    latest.sequence++;
+    latest.load = load;
+    latest.sampled_at = sampler_time_ms();
+    latest.stats = *stats;
+    sampler_publish(&latest);
+    history_append(latest.sampled_at, load, stats);
+
+    for (unsigned i = 0; i < notify_event_count; i++) {
+        if (write(notify_event_fds[i], &one, sizeof(one)) == -1) {
+            // Counter overflow can't happen in practice, the event loop reads it regularly
+            fprintf(stderr, "Cannot notify about new CPU load sample\n");
+        }
+    }
+}
+
+/**
+ * Checks if the lazy sampler should stop (no sample has been demanded for the idle window)
+ *
+ * Requests check the running flag after updating the demand time, the sampler checks the demand time
+ * after clearing the flag. So either the sampler sees the new demand or the request sees the stopped sampler.
+ *
+ * @return Should the sampler thread end?
+ * @pre The lock is held by the caller
+ */
+bool sampler_idle(void) {
+    if (idle_window_ms == 0
+        || sampler_monotonic_ms() - __atomic_load_n(&last_demand_ms, __ATOMIC_SEQ_CST) < idle_window_ms) {
+        return false;
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_SEQ_CST);
+    if (sampler_monotonic_ms() - __atomic_load_n(&last_demand_ms, __ATOMIC_SEQ_CST) < idle_window_ms) {
+        __atomic_store_n(&running, true, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Main function of the sampler thread
+ *
+ * @param arg Unused
+ * @return Always NULL
+ */
+void *sampler_run(void *arg) {
+    struct proc_stats prev_st;
+    struct proc_stats curr_st;
+    struct timespec deadline;
+    int load;
+
+    (void) arg;
+
+    // CPUs are set at the creation of the thread, the memory policy must be set by the thread itself
+    affinity_bind_memory(sampler_affinity);
+
+    pthread_mutex_lock(&lock);
+
+    if (load_proc_stats(&prev_st) != 0) {
+        __atomic_store_n(&running, false, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+
+    // The first sample is taken quickly, so the server has some value early
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add_ms(&deadline, CPU_LOAD_WINDOW);
+
+    while (!sampler_wait(&deadline)) {
+        if (sampler_idle()) {
+            // The last sample is out of date when the sampler is started again, requests must wait for a new one
+            // (sequential numbers continue, so caches of the old sample aren't mistaken for new ones)
+            sampler_publish(&(struct cpu_load_sample) {0});
+            break;
+        }
+
+        // Deadlines are absolute, so the sampling period doesn't drift
+        timespec_add_ms(&deadline, sampling_interval * 1000UL);
+
+        pthread_mutex_unlock(&lock);
+        if (load_proc_stats(&curr_st) != 0) {
+            pthread_mutex_lock(&lock);
+            continue;
+        }
+        load = compute_cpu_load(&prev_st, &curr_st);
+        prev_st = curr_st;
+        pthread_mutex_lock(&lock);
+
+        if (load < 0) {
+            continue;
+        }
+
+        sampler_record_locked(load, &curr_st);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * Creates the sampler thread
+ *
+ * @return 0 => success, 1 => error
+ * @pre The lock is held by the caller
+ */
+int sampler_spawn(void) {
+    pthread_attr_t thread_attr;
+    int result;
+
+    // Thread of the lazy sampler that has gone idle has already released the lock, so it ends soon
+    if (started) {
+        pthread_join(thread, NULL);
+        started = false;
+    }
+
+    // Pinned sampler doesn't migrate across the measured CPUs
+    pthread_attr_init(&thread_attr);
+    if (affinity_set_attr(&thread_attr, sampler_affinity) != 0) {
+        pthread_attr_destroy(&thread_attr);
+        return 1;
+    }
+    result = pthread_create(&thread, &thread_attr, sampler_run, NULL);
+    pthread_attr_destroy(&thread_attr);
+
+    if (result != 0) {
+        fprintf(stderr, "Cannot start sampler thread\n");
+        return 1;
+    }
+
+    started = true;
+    __atomic_store_n(&running, true, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/**
+ * Starts the sampler in a background thread
+ *
+ * The first sample is taken after CPU_LOAD_WINDOW, then one sample per interval is taken.
+ * Lazy sampler (non-zero idle window) is started by the first sampler_demand() instead.
+ *
+ * @param interval Sampling interval (in seconds)
+ * @param idle_window Idle window of lazy sampler (in seconds, 0 => the sampler runs all the time)
+ * @param notify_fds Event file descriptors (eventfd) to notify after each sample
+ * @param notify_count Number of the file descriptors (at most SAMPLER_MAX_NOTIFY)
+ * @param affinity Placement of the sampler thread (NULL => the thread isn't pinned)
+ * @return 0 => success, 1 => error
+ */
+int sampler_start(unsigned interval, unsigned idle_window, const int *notify_fds, unsigned notify_count,
+                  const struct cpu_affinity *affinity) {
+    pthread_condattr_t cond_attr;
+    int result;
+
+    if (notify_count > SAMPLER_MAX_NOTIFY) {
+        fprintf(stderr, "Too many file descriptors to notify by the sampler (maximum is %d)\n", SAMPLER_MAX_NOTIFY);
+        return 1;
+    }
+
+    // Deadlines are computed in monotonic clock, so the condition must use it too
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wake_up, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    sampling_interval = interval;
+    memcpy(notify_event_fds, notify_fds, notify_count * sizeof(*notify_fds));
+    notify_event_count = notify_count;
+    sampler_affinity = affinity;
+    idle_window_ms = idle_window * 1000ULL;
+    stop_requested = false;
+
+    if (idle_window_ms > 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    result = sampler_spawn();
+    pthread_mutex_unlock(&lock);
+
+    return result;
+}
+
+/**
+ * Starts the coalescing sampler (no thread is started, event loops record samples by sampler_record())
+ *
+ * @param interval Sampling interval (in seconds), a sample is valid for this time
+ * @param notify_fds Event file descriptors (eventfd) to notify after each sample
+ * @param notify_count Number of the file descriptors (at most SAMPLER_MAX_NOTIFY)
+ * @return 0 => success, 1 => error
+ */
+int sampler_start_coalescing(unsigned interval, const int *notify_fds, unsigned notify_count) {
+    if (notify_count > SAMPLER_MAX_NOTIFY) {
+        fprintf(stderr, "Too many file descriptors to notify by the sampler (maximum is %d)\n", SAMPLER_MAX_NOTIFY);
+        return 1;
+    }
+
+    sampling_interval = interval;
+    memcpy(notify_event_fds, notify_fds, notify_count * sizeof(*notify_fds));
+    notify_event_count = notify_count;
+    coalescing = true;
+
+    return 0;
+}
+
+/**
+ * Records a sample measured by an event loop (coalescing sampler)
+ *
+ * All event loops are notified, so requests waiting in any of them get the sample.
+ *
+ * @param load CPU load in %
+ * @param stats CPU statistics the load was computed from (end of the measuring)
+ */
+void sampler_record(int load, const struct proc_stats *stats) {
+    pthread_mutex_lock(&lock);
+    sampler_record_locked(load, stats);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Tells the sampler that samples are demanded (lazy sampler is started if it isn't running)
+ */
+void sampler_demand(void) {
+    unsigned long long now;
+
+    if (idle_window_ms == 0) {
+        return;
+    }
+
+    // All workers demand samples, so the shared time is written just when it moves noticeably
+    // (readers don't invalidate the cache line of each other)
+    now = sampler_monotonic_ms();
+    if (now - __atomic_load_n(&last_demand_ms, __ATOMIC_RELAXED) >= SAMPLER_DEMAND_GRANULARITY) {
+        __atomic_store_n(&last_demand_ms, now, __ATOMIC_SEQ_CST);
+    }
+
+    if (__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!running && !stop_requested && sampler_spawn() != 0) {
+        fprintf(stderr, "Cannot start sampler on demand\n");
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Stops the sampler and waits for the end of its thread
+ */
+void sampler_stop(void) {
+    // Lazy sampler can be started by workers, so the thread is checked under the lock
+    pthread_mutex_lock(&lock);
+    stop_requested = true;
+    pthread_cond_signal(&wake_up);
+    pthread_mutex_unlock(&lock);
+
+    if (!started) {
+        return;
+    }
+
+    pthread_join(thread, NULL);
+    started = false;
+}
+
+/**
+ * Returns the latest sample of CPU load
+ *
+ * It never takes a lock and never returns a partially written sample (it is safe to call from any thread).
+ *
+ * @param sample Pointer to the place where to save the sample
+ * @return Is any sample available?
+ */
+bool sampler_get(struct cpu_load_sample *sample) {
+    union sample_words copy;
+    unsigned long generation;
+
+    do {
+        // Writer is in the middle of publishing (it takes just a few stores)
+        while ((generation = __atomic_load_n(&published.generation, __ATOMIC_ACQUIRE)) & 1) {
+        }
+
+        for (size_t i = 0; i < SAMPLE_WORDS; i++) {
+            copy.words[i] = __atomic_load_n(&published.data.words[i], __ATOMIC_RELAXED);
+        }
+
+        // The copy is valid only if no writing has started meanwhile
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&published.generation, __ATOMIC_RELAXED) != generation);
+
+    *sample = copy.sample;
+
+    // Sample of coalescing sampler isn't refreshed in the background, so it expires
+    if (coalescing && sampler_time_ms() - sample->sampled_at >= sampling_interval * 1000ULL) {
+        return false;
+    }
+
+    return sample->sequence != 0;
+}
@@ -0,0 +1,93 @@
+#ifndef HINFOSVC_SAMPLER_H
+#define HINFOSVC_SAMPLER_H
+/**
+ * @file sampler.h
+ * Header of background sampler of CPU load
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include "system-info.h"
+
+/**
+ * Maximum number of event file descriptors notified after each sample (one per worker)
+ */
+#define SAMPLER_MAX_NOTIFY 64
+/**
+ * Precision of the time of the last demand for samples (in milliseconds)
+ */
+#define SAMPLER_DEMAND_GRANULARITY 100
+
+struct cpu_affinity;
+
+/**
+ * Sample of CPU load taken by the sampler
+ */
+struct cpu_load_sample {
+    // Sequential number of the sample (starts from 1)
+    unsigned long long sequence;
+    // CPU load in %
+    int load;
+    // Time when the sample was taken (Unix time in milliseconds)
+    unsigned long long sampled_at;
+    // CPU statistics the sample was computed from (end of the measuring)
+    struct proc_stats stats;
+};
+
+/**
+ * Starts the sampler in a background thread
+ *
+ * The first sample is taken after CPU_LOAD_WINDOW, then one sample per interval is taken.
+ * Lazy sampler (non-zero idle window) is started by the first sampler_demand() instead.
+ *
+ * @param interval Sampling interval (in seconds)
+ * @param idle_window Idle window of lazy sampler (in seconds, 0 => the sampler runs all the time)
+ * @param notify_fds Event file descriptors (eventfd) to notify after each sample
+ * @param notify_count Number of the file descriptors (at most SAMPLER_MAX_NOTIFY)
+ * @param affinity Placement of the sampler thread (NULL => the thread isn't pinned)
+ * @return 0 => success, 1 => error
+ */
+int sampler_start(unsigned interval, unsigned idle_window, const int *notify_fds, unsigned notify_count,
+                  const struct cpu_affinity *affinity);
+
+/**
+ * Starts the coalescing sampler (no thread is started, event loops record samples by sampler_record())
+ *
+ * @param interval Sampling interval (in seconds), a sample is valid for this time
+ * @param notify_fds Event file descriptors (eventfd) to notify after each sample
+ * @param notify_count Number of the file descriptors (at most SAMPLER_MAX_NOTIFY)
+ * @return 0 => success, 1 => error
+ */
+int sampler_start_coalescing(unsigned interval, const int *notify_fds, unsigned notify_count);
+
+/**
+ * Records a sample measured by an event loop (coalescing sampler)
+ *
+ * All event loops are notified, so requests waiting in any of them get the sample.
+ *
+ * @param load CPU load in %
+ * @param stats CPU statistics the load was computed from (end of the measuring)
+ */
+void sampler_record(int load, const struct proc_stats *stats);
+
+/**
+ * Tells the sampler that samples are demanded (lazy sampler is started if it isn't running)
+ */
+void sampler_demand(void);
+
+/**
+ * Stops the sampler and waits for the end of its thread
+ */
+void sampler_stop(void);
+
+/**
+ * Returns the latest sample of CPU load
+ *
+ * It never takes a lock and never returns a partially written sample (it is safe to call from any thread).
+ *
+ * @param sample Pointer to the place where to save the sample
+ * @return Is any sample available?
+ */
+bool sampler_get(struct cpu_load_sample *sample);
+
+#endif //HINFOSVC_SAMPLER_H
@@ -0,0 +1,1136 @@
+/**
+ * @file server.c
+ * Event loop serving HTTP connections
+ *
+ * All sockets are non-blocking and watched by a single epoll instance, so slow clients
+ * (and long-lived event streams) don't block other connections. More servers (workers) can share
+ * the same welcome sockets, each of them runs in its own thread then.
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#define _GNU_SOURCE // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include "server.h"
+#include "sampler.h"
+
+/**
+ * Maximum number of events processed in one iteration of the event loop
+ */
+#define MAX_EVENTS 64
+/**
+ * Initial length of response message buffer (header + body).
+ * It is based on items' limits and the header skeleton (the buffer grows for longer responses)
+ */
+#define OUTPUT_BUFFER_LEN 512
+/**
+ * Time a rejected client has for closing the connection when lingering isn't configured (in milliseconds)
+ */
+#define REJECT_LINGER_TIMEOUT 1000
+/**
+ * Maximum number of lingering rejected connections per event loop (others are closed at once)
+ */
+#define MAX_REJECTED_LINGERING 1024
+
+/**
+ * Inserts the connection to the list of connections waiting for samples
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to insert
+ */
+void waiting_list_add(struct server *server, struct connection *connection) {
+    connection->prev_waiting = NULL;
+    connection->next_waiting = server->waiting;
+    if (server->waiting != NULL) {
+        server->waiting->prev_waiting = connection;
+    }
+    server->waiting = connection;
+}
+
+/**
+ * Removes the connection from the list of connections waiting for samples
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to remove
+ */
+void waiting_list_remove(struct server *server, struct connection *connection) {
+    if (connection->prev_waiting != NULL) {
+        connection->prev_waiting->next_waiting = connection->next_waiting;
+    } else {
+        server->waiting = connection->next_waiting;
+    }
+    if (connection->next_waiting != NULL) {
+        connection->next_waiting->prev_waiting = connection->prev_waiting;
+    }
+
+    connection->prev_waiting = NULL;
+    connection->next_waiting = NULL;
+    admission_unpark(&server->admission);
+}
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in milliseconds
+ */
+unsigned long long server_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+}
+
+/**
+ * Arms the timer of lingering connections by the deadline of the first one (or disarms it if there is none)
+ *
+ * @param server Server the timer belongs to
+ */
+void arm_linger(struct server *server) {
+    struct itimerspec timer = {0};
+    unsigned long long now = server_time_ms();
+    unsigned long long ms;
+
+    if (server->lingering != NULL) {
+        // Zero would disarm the timer, so passed deadlines expire in a millisecond
+        ms = server->lingering->linger_deadline > now ? server->lingering->linger_deadline - now : 1;
+        timer.it_value.tv_sec = (time_t) (ms / 1000);
+        timer.it_value.tv_nsec = (long) (ms % 1000) * 1000000;
+    }
+
+    if (timerfd_settime(server->linger.fd, 0, &timer, NULL) == -1) {
+        fprintf(stderr, "Cannot arm timer of lingering connections\n");
+    }
+}
+
+/**
+ * Removes the connection from the list of lingering connections
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to remove
+ */
+void lingering_list_remove(struct server *server, struct connection *connection) {
+    if (connection->prev_lingering != NULL) {
+        connection->prev_lingering->next_lingering = connection->next_lingering;
+    } else {
+        server->lingering = connection->next_lingering;
+    }
+    if (connection->next_lingering != NULL) {
+        connection->next_lingering->prev_lingering = connection->prev_lingering;
+    } else {
+        server->lingering_last = connection->prev_lingering;
+    }
+
+    connection->prev_lingering = NULL;
+    connection->next_lingering = NULL;
+}
+
+/**
+ * Closes the connection (it is released at the end of the current iteration of the event loop)
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to close
+ */
+void close_connection(struct server *server, struct connection *connection) {
+    if (connection->state == CLOSED_C) {
+        return;
+    }
+
+    if (connection->state == WAITING_SAMPLE_C || connection->state == STREAMING_C) {
+        waiting_list_remove(server, connection);
+    }
+    if (connection->rejected) {
+        server->rejected_lingering--;
+    }
+    if (connection->state == COLLECTING_C) {
+        collect_waiter_remove(&connection->collect_waiter);
+    }
+    if (connection->state == LINGERING_C) {
+        lingering_list_remove(server, connection);
+    }
+
+    // The side closing first keeps TIME_WAIT (UNIX sockets have none, but they are counted the same way),
+    // rejected connections have sent FIN right behind the response
+    listener_stats_increment(connection->peer_closed && !connection->rejected ? &connection->stats->passive_closes
+                                                                              : &connection->stats->active_closes);
+
+    // Requests that end before completing the response are traced too
+    if (!connection->trace_finished) {
+        trace_mark(&connection->trace, TRACE_WRITE_END);
+        trace_finish(&connection->trace);
+    }
+
+    // Closing removes the socket from epoll
+    if (close(connection->handler.fd) == -1) {
+        fprintf(stderr, "Cannot close connection socket\n");
+    }
+    connection->state = CLOSED_C;
+    if (!connection->rejected) {
+        listener_stats_decrement(&connection->stats->active);
+        admission_leave(&server->admission);
+    }
+
+    // Move from the list of open connections to the list of closed ones
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        server->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+    connection->prev = NULL;
+    connection->next = server->closed;
+    server->closed = connection;
+}
+
+/**
+ * Releases closed connections (events of the current iteration can't refer to them anymore)
+ *
+ * @param server Server the connections belong to
+ */
+void release_closed_connections(struct server *server) {
+    struct connection *next;
+
+    while (server->closed != NULL) {
+        next = server->closed->next;
+        string_buffer_free(&server->closed->output);
+        free(server->closed->input);
+        free(server->closed);
+        server->closed = next;
+    }
+}
+
+/**
+ * Changes watched events of the connection socket
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to change
+ * @param watch_write Should be writability watched?
+ * @return 0 => success, 1 => error
+ */
+int watch_events(struct server *server, struct connection *connection, bool watch_write) {
+    struct epoll_event event = {.events = 0, .data.ptr = connection};
+
+    // Half-closed client sends nothing more (its EOF would be reported again and again by level-triggered epoll)
+    if (!connection->peer_closed) {
+        event.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (watch_write) {
+        event.events |= EPOLLOUT;
+    }
+
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->handler.fd, &event) == -1) {
+        fprintf(stderr, "Cannot change watched events of connection socket\n");
+        return 1;
+    }
+
+    connection->watch_write = watch_write;
+    return 0;
+}
+
+/**
+ * Turns on/off watching of the socket's writability
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to change
+ * @param watch Should be writability watched?
+ * @return 0 => success, 1 => error
+ */
+int watch_writability(struct server *server, struct connection *connection, bool watch) {
+    if (connection->watch_write == watch) {
+        return 0;
+    }
+
+    return watch_events(server, connection, watch);
+}
+
+/**
+ * Moves the connection to the list of lingering connections (it is closed when the client closes or at the deadline)
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to linger
+ */
+void linger_connection(struct server *server, struct connection *connection) {
+    // Rejected connections linger without -T too, then they are the only ones in the list (deadlines keep order)
+    unsigned timeout = server->linger_timeout > 0 ? server->linger_timeout : REJECT_LINGER_TIMEOUT;
+
+    // Deadlines are increasing, so the new connection belongs to the end of the list
+    connection->state = LINGERING_C;
+    connection->linger_deadline = server_time_ms() + timeout;
+    connection->prev_lingering = server->lingering_last;
+    connection->next_lingering = NULL;
+    if (server->lingering_last != NULL) {
+        server->lingering_last->next_lingering = connection;
+    } else {
+        server->lingering = connection;
+        arm_linger(server);
+    }
+    server->lingering_last = connection;
+}
+
+/**
+ * Finishes the connection after sending the response
+ *
+ * The client should close the connection first (it knows the length of the response), so the server doesn't
+ * collect TIME_WAIT. The server waits for that without blocking and closes the connection itself after the timeout.
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection with sent response
+ */
+void finish_connection(struct server *server, struct connection *connection) {
+    if (server->linger_timeout == 0 || connection->peer_closed) {
+        close_connection(server, connection);
+        return;
+    }
+
+    if (watch_writability(server, connection, false) != 0) {
+        close_connection(server, connection);
+        return;
+    }
+
+    linger_connection(server, connection);
+}
+
+/**
+ * Closes lingering connections whose clients haven't closed them in time
+ *
+ * @param server Server the connections belong to
+ */
+void handle_linger(struct server *server) {
+    unsigned long long now = server_time_ms();
+    uint64_t expirations;
+
+    // Reset the expiration counter
+    if (read(server->linger.fd, &expirations, sizeof(expirations)) == -1) {
+        return;
+    }
+
+    while (server->lingering != NULL && server->lingering->linger_deadline <= now) {
+        close_connection(server, server->lingering);
+    }
+
+    arm_linger(server);
+}
+
+/**
+ * Sends as much of waiting output as the socket accepts
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to send data to
+ */
+void flush_connection(struct server *server, struct connection *connection) {
+    ssize_t written;
+
+    while (connection->output_sent < connection->output.length) {
+        written = send(connection->handler.fd, &connection->output.data[connection->output_sent],
+                       connection->output.length - connection->output_sent, MSG_NOSIGNAL);
+
+        if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The rest will be sent when the socket is writable again
+            if (watch_writability(server, connection, true) != 0) {
+                close_connection(server, connection);
+            }
+            return;
+        } else if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1) {
+            // Client has closed the connection (or other error)
+            close_connection(server, connection);
+            return;
+        }
+
+        connection->output_sent += written;
+    }
+
+    // All data have been sent
+    if (!connection->trace_finished) {
+        trace_mark(&connection->trace, TRACE_WRITE_END);
+        trace_finish(&connection->trace);
+        connection->trace_finished = true;
+    }
+
+    if (connection->state == WRITING_C) {
+        finish_connection(server, connection);
+        return;
+    }
+
+    // Event stream: a sample could have come while the previous event has been sent, the latest one is sent now
+    string_buffer_clear(&connection->output);
+    connection->output_sent = 0;
+    if (format_load_event(&connection->output, &connection->stream_sequence) == 0) {
+        flush_connection(server, connection);
+        return;
+    }
+
+    if (watch_writability(server, connection, false) != 0) {
+        close_connection(server, connection);
+    }
+}
+
+/**
+ * Arms the timer of the measuring window
+ *
+ * @param server Server the timer belongs to
+ * @param ms Time to the expiration (in milliseconds)
+ * @param phase Phase of the window after arming
+ */
+void arm_window(struct server *server, unsigned long ms, enum window_phase phase) {
+    struct itimerspec timer = {0};
+
+    timer.it_value.tv_sec = (time_t) (ms / 1000);
+    timer.it_value.tv_nsec = (long) (ms % 1000) * 1000000;
+    if (timerfd_settime(server->window.fd, 0, &timer, NULL) == -1) {
+        fprintf(stderr, "Cannot arm timer of measuring window\n");
+        return;
+    }
+
+    server->window_phase = phase;
+}
+
+/**
+ * Opens the measuring window by loaded CPU statistics
+ *
+ * @param server Server to measure for
+ * @param result Result of loading of the statistics (0 => success)
+ * @param stats CPU statistics of the start of the window
+ */
+void open_window(struct server *server, int result, const struct proc_stats *stats) {
+    if (result != 0) {
+        fprintf(stderr, "Cannot load CPU statistics\n");
+        server->window_phase = IDLE_W;
+        return;
+    }
+
+    server->window_start = *stats;
+    arm_window(server, CPU_LOAD_WINDOW, MEASURING_W);
+}
+
+/**
+ * Starts loading of CPU statistics of the measuring window by the offload pool
+ *
+ * @param server Server to measure for
+ * @param phase Phase of the window during the loading (OPENING_W or CLOSING_W)
+ * @return 0 => success, 1 => error (there is no offload pool, load the statistics directly)
+ */
+int load_window_stats(struct server *server, enum window_phase phase) {
+    if (offload_submit(&server->window_job.job, &server->completions) != 0) {
+        return 1;
+    }
+
+    // Zero time disarms the timer (delayed measuring starts right now)
+    arm_window(server, 0, phase);
+    return 0;
+}
+
+/**
+ * Starts the measuring window, all requests parked until its end get the same sample
+ *
+ * @param server Server to measure for
+ */
+void start_window(struct server *server) {
+    struct proc_stats stats;
+
+    if (!server->coalescing || server->window_phase == MEASURING_W || server->window_phase == OPENING_W
+        || server->window_phase == CLOSING_W) {
+        return;
+    }
+
+    if (load_window_stats(server, OPENING_W) != 0) {
+        open_window(server, load_proc_stats(&stats), &stats);
+    }
+}
+
+/**
+ * Closes the measuring window by loaded CPU statistics and records the measured sample
+ *
+ * @param server Server to measure for
+ * @param result Result of loading of the statistics (0 => success)
+ * @param stats CPU statistics of the end of the window
+ */
+void close_window(struct server *server, int result, const struct proc_stats *stats) {
+    int load;
+
+    server->window_phase = IDLE_W;
+    if (result != 0 || (load = compute_cpu_load(&server->window_start, stats)) < 0) {
+        // Parked requests stay waiting, the measuring is tried again
+        start_window(server);
+        return;
+    }
+
+    // Parked requests of all event loops are woken up by the notification of the sampler
+    sampler_record(load, stats);
+}
+
+/**
+ * Loads CPU statistics of the measuring window (in a thread of the offload pool)
+ *
+ * @param job Loading job of the window
+ */
+void window_work(struct offload_job *job) {
+    struct window_job *window = (struct window_job *) job;
+
+    window->result = load_proc_stats(&window->stats);
+}
+
+/**
+ * Opens or closes the measuring window by CPU statistics loaded by the offload pool
+ *
+ * @param job Finished loading job of the window
+ */
+void window_complete(struct offload_job *job) {
+    struct window_job *window = (struct window_job *) job;
+
+    if (window->server->window_phase == OPENING_W) {
+        open_window(window->server, window->result, &window->stats);
+    } else {
+        close_window(window->server, window->result, &window->stats);
+    }
+}
+
+/**
+ * Handles the expiration of the window timer (the start of delayed measuring or the end of the measuring)
+ *
+ * @param server Server the timer belongs to
+ */
+void handle_window(struct server *server) {
+    struct proc_stats window_end;
+    uint64_t expirations;
+
+    if (read(server->window.fd, &expirations, sizeof(expirations)) == -1) {
+        return;
+    }
+
+    if (server->window_phase == DELAYED_W) {
+        server->window_phase = IDLE_W;
+        start_window(server);
+        return;
+    }
+
+    // Timer of delayed measuring could have fired before it has been disarmed by loading of the statistics
+    if (server->window_phase != MEASURING_W) {
+        return;
+    }
+
+    if (load_window_stats(server, CLOSING_W) != 0) {
+        close_window(server, load_proc_stats(&window_end), &window_end);
+    }
+}
+
+/**
+ * Answers the request by the prebuilt 503 response (the event loop can't take more waiting requests)
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection with loaded request
+ */
+void shed_request(struct server *server, struct connection *connection) {
+    listener_stats_increment(&connection->stats->shed);
+
+    string_buffer_clear(&connection->output);
+    if (string_buffer_append(&connection->output, server->admission.response,
+                             server->admission.response_length) != 0) {
+        close_connection(server, connection);
+        return;
+    }
+
+    connection->state = WRITING_C;
+    connection->output_sent = 0;
+    flush_connection(server, connection);
+}
+
+/**
+ * Processes the loaded request and starts sending the response
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection with loaded request
+ */
+void respond(struct server *server, struct connection *connection) {
+    // Requests waiting for a sample are processed again, they are counted just for the first time
+    if (connection->state == READING_C) {
+        listener_stats_increment(&connection->stats->requests);
+    }
+
+    switch (process_http_request(&connection->parser, connection->loading_result, &connection->output,
+                                 &connection->trace, &connection->collect_waiter)) {
+        case 0:
+            connection->state = WRITING_C;
+            connection->output_sent = 0;
+            flush_connection(server, connection);
+            break;
+        case 2:
+            // Processing is repeated after the next sample (if there is a place for another waiting request)
+            if (!admission_park(&server->admission)) {
+                shed_request(server, connection);
+                break;
+            }
+            connection->state = WAITING_SAMPLE_C;
+            waiting_list_add(server, connection);
+            start_window(server);
+            break;
+        case 4:
+            // Processing is repeated after the offload pool collects the body (the request waits for it)
+            connection->state = COLLECTING_C;
+            break;
+        case 3:
+            if (!admission_park(&server->admission)) {
+                shed_request(server, connection);
+                break;
+            }
+            connection->state = STREAMING_C;
+            connection->output_sent = 0;
+            waiting_list_add(server, connection);
+            start_window(server);
+
+            // The current sample is sent right after the head of the stream
+            format_load_event(&connection->output, &connection->stream_sequence);
+            flush_connection(server, connection);
+            break;
+        default:
+            fprintf(stderr, "Cannot process HTTP request\n");
+            close_connection(server, connection);
+    }
+}
+
+/**
+ * Reads available data from the connection
+ *
+ * @param server Server the connection belongs to
+ * @param connection Connection to read from
+ */
+void read_connection(struct server *server, struct connection *connection) {
+    char read_buffer[INPUT_BUFFER_LEN];
+    struct http_parser *parser = &connection->parser;
+    ssize_t read_bytes;
+    size_t consumed;
+    int result;
+
+    while (connection->state != CLOSED_C) {
+        if (connection->state == READING_C) {
+            // HTTP head is received right behind its loaded part, so the parser works on it in place
+            read_bytes = read(connection->handler.fd, connection->input + parser->head_length,
+                              parser->head_capacity - parser->head_length);
+        } else {
+            read_bytes = read(connection->handler.fd, read_buffer, sizeof(read_buffer));
+        }
+
+        if (read_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else if (read_bytes == -1 && errno == EINTR) {
+            continue;
+        } else if (read_bytes == -1) {
+            close_connection(server, connection);
+            return;
+        }
+
+        if (read_bytes == 0) {
+            // Half-close isn't an abort, the client still reads the response (parked requests are finished too)
+            connection->peer_closed = true;
+            if (connection->state == READING_C) {
+                // End of the HTTP request but the HTTP head wasn't correctly ended
+                connection->loading_result = 2;
+                respond(server, connection);
+            } else if (connection->state == LINGERING_C) {
+                // The client has closed first, as expected after the response
+                close_connection(server, connection);
+            }
+
+            if (connection->state != CLOSED_C && watch_events(server, connection, connection->watch_write) != 0) {
+                close_connection(server, connection);
+            }
+            return;
+        }
+
+        // The connection is closed after the response, so data behind the HTTP head (or while lingering) are ignored
+        if (connection->state != READING_C) {
+            continue;
+        }
+
+        if (parser->head_length == 0) {
+            trace_mark(&connection->trace, TRACE_FIRST_BYTE);
+        }
+
+        result = http_parser_feed(parser, (size_t) read_bytes, &consumed);
+        if (result != 3) {
+            if (result == 0) {
+                trace_mark(&connection->trace, TRACE_HEADERS_END);
+            }
+
+            connection->loading_result = result;
+            respond(server, connection);
+        }
+    }
+}
+
+/**
+ * Closes the socket after dropping already received data (closing with unread data would reset the connection)
+ *
+ * @param conn_socket Connection socket to close
+ */
+void drain_and_close(int conn_socket) {
+    char buffer[INPUT_BUFFER_LEN];
+
+    while (read(conn_socket, buffer, sizeof(buffer)) > 0) {
+        // Received data are just dropped
+    }
+
+    close(conn_socket);
+}
+
+/**
+ * Rejects the connection by the prebuilt response (the request isn't processed at all)
+ *
+ * The socket isn't closed at once: unread request would make the close send RST and the client could lose
+ * the response. The response is followed by FIN and the socket lingers until the client closes it too.
+ *
+ * @param server Server the connection belongs to
+ * @param listener Welcome socket the connection has been accepted by
+ * @param conn_socket Accepted connection socket
+ * @param response Prebuilt response (429 of rate limiting or 503 of admission control)
+ * @param length Length of the response
+ */
+void reject_connection(struct server *server, struct listener *listener, int conn_socket, const char *response,
+                       size_t length) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP};
+    struct connection *connection;
+
+    // Send buffer of a new socket is empty, so the short response fits there at once
+    if (send(conn_socket, response, length, MSG_NOSIGNAL) == -1) {
+        fprintf(stderr, "Cannot send rejecting response\n");
+    }
+
+    // Flood of rejected clients can't take more memory and file descriptors, the rest is closed at once
+    if (shutdown(conn_socket, SHUT_WR) == -1 || server->rejected_lingering >= MAX_REJECTED_LINGERING
+        || (connection = calloc(1, sizeof(*connection))) == NULL) {
+        drain_and_close(conn_socket);
+        return;
+    }
+
+    connection->handler.type = CONNECTION_H;
+    connection->handler.fd = conn_socket;
+    connection->stats = listener->stats;
+    connection->rejected = true;
+    connection->trace_finished = true;
+
+    event.data.ptr = connection;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn_socket, &event) == -1) {
+        free(connection);
+        drain_and_close(conn_socket);
+        return;
+    }
+
+    connection->next = server->connections;
+    if (server->connections != NULL) {
+        server->connections->prev = connection;
+    }
+    server->connections = connection;
+    server->rejected_lingering++;
+    linger_connection(server, connection);
+
+    // The request (or even the close) could be already there
+    read_connection(server, connection);
+}
+
+/**
+ * Accepts all waiting connections
+ *
+ * @param server Server to accept connections for
+ * @param listener Welcome socket
+ */
+void accept_connections(struct server *server, struct listener *listener) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP};
+    struct connection *connection;
+    struct sockaddr_storage peer;
+    socklen_t peer_length = sizeof(peer);
+    bool allowed;
+    int conn_socket;
+
+    while ((conn_socket = accept4(listener->handler.fd, (struct sockaddr *) &peer, &peer_length,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        allowed = rate_limiter_allow(server->limiter, (struct sockaddr *) &peer, peer_length);
+        // Length of the address is in-out argument, so it must be reset for the next accept
+        peer_length = sizeof(peer);
+        if (!allowed) {
+            listener_stats_increment(&listener->stats->rejected);
+            reject_connection(server, listener, conn_socket, server->limiter->response,
+                              server->limiter->response_length);
+            continue;
+        }
+
+        // Overloaded event loop answers quickly that it is busy instead of queueing more work
+        if (!admission_enter(&server->admission)) {
+            listener_stats_increment(&listener->stats->shed);
+            reject_connection(server, listener, conn_socket, server->admission.response,
+                              server->admission.response_length);
+            continue;
+        }
+
+        if ((connection = calloc(1, sizeof(*connection))) == NULL
+            || (connection->input = malloc(http_head_capacity())) == NULL
+            || string_buffer_init(&connection->output, OUTPUT_BUFFER_LEN + 1) != 0) {
+            fprintf(stderr, "Cannot allocate memory for connection\n");
+            if (connection != NULL) {
+                free(connection->input);
+            }
+            free(connection);
+            close(conn_socket);
+            admission_leave(&server->admission);
+            continue;
+        }
+
+        connection->handler.type = CONNECTION_H;
+        connection->handler.fd = conn_socket;
+        connection->state = READING_C;
+        connection->stats = listener->stats;
+        http_parser_init(&connection->parser, connection->input, http_head_capacity());
+        trace_start(&connection->trace);
+
+        event.data.ptr = connection;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn_socket, &event) == -1) {
+            fprintf(stderr, "Cannot watch connection socket\n");
+            string_buffer_free(&connection->output);
+            free(connection->input);
+            free(connection);
+            close(conn_socket);
+            admission_leave(&server->admission);
+            continue;
+        }
+
+        connection->next = server->connections;
+        if (server->connections != NULL) {
+            server->connections->prev = connection;
+        }
+        server->connections = connection;
+        listener_stats_increment(&listener->stats->accepted);
+        listener_stats_increment(&listener->stats->active);
+
+        // Data of the request could be already there
+        read_connection(server, connection);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fprintf(stderr, "Cannot create connection socket for data transfer\n");
+    }
+}
+
+/**
+ * Handles a new sample of CPU load (wakes up waiting connections and sends stream events)
+ *
+ * @param server Server to handle sample for
+ */
+void handle_sample(struct server *server) {
+    struct connection *connection = server->waiting;
+    struct connection *next;
+    uint64_t counter;
+
+    // Reset the notification counter
+    if (read(server->sampler.fd, &counter, sizeof(counter)) == -1) {
+        return;
+    }
+
+    while (connection != NULL) {
+        next = connection->next_waiting;
+
+        if (connection->state == WAITING_SAMPLE_C) {
+            waiting_list_remove(server, connection);
+            respond(server, connection);
+        } else if (connection->output_sent == connection->output.length) {
+            // Slow consumers (still sending the previous event) get the latest sample after finishing the sending
+            string_buffer_clear(&connection->output);
+            connection->output_sent = 0;
+            if (format_load_event(&connection->output, &connection->stream_sequence) == 0) {
+                flush_connection(server, connection);
+            }
+        }
+
+        connection = next;
+    }
+
+    // Streams of coalescing sampler get the next sample after the sampling interval
+    if (server->coalescing && server->waiting != NULL && server->window_phase == IDLE_W) {
+        arm_window(server, server->load_interval * 1000UL - CPU_LOAD_WINDOW, DELAYED_W);
+    }
+}
+
+/**
+ * Handles jobs finished by the offload pool and processes requests waiting for collected bodies again
+ *
+ * @param server Server the jobs belong to
+ */
+void handle_offload(struct server *server) {
+    struct collect_waiter *waiter;
+    struct connection *connection;
+
+    offload_complete(&server->completions);
+
+    // Just requests of the finished jobs are woken up, the others keep waiting for their bodies
+    while ((waiter = take_collected_waiter()) != NULL) {
+        connection = (struct connection *) ((char *) waiter - offsetof(struct connection, collect_waiter));
+        trace_mark(&connection->trace, TRACE_COLLECT_END);
+        respond(server, connection);
+    }
+}
+
+/**
+ * Starts watching the file descriptor by the event loop
+ *
+ * @param server Server to watch for
+ * @param handler Handler of the file descriptor
+ * @param events Watched events
+ * @return 0 => success, 1 => error
+ */
+int watch_handler(struct server *server, struct event_handler *handler, uint32_t events) {
+    struct epoll_event event = {.events = events, .data.ptr = handler};
+
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, handler->fd, &event) == -1) {
+        fprintf(stderr, "Cannot watch file descriptor by event loop\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Inits the server (event loop)
+ *
+ * @param server Server to init
+ * @param config Configuration of the server
+ * @param int_signal SIGINT file descriptor
+ * @param limiter Per-client rate limiter (shared by all servers)
+ * @return 0 => success, 1 => error
+ */
+int server_init(struct server *server, const struct server_config *config, int int_signal,
+                struct rate_limiter *limiter) {
+    memset(server, 0, sizeof(*server));
+    server->keep_running = true;
+    server->limiter = limiter;
+
+    if ((server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        fprintf(stderr, "Cannot create event loop\n");
+        return 1;
+    }
+
+    if ((server->sampler.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        fprintf(stderr, "Cannot create sampler notification file descriptor\n");
+        close(server->epoll_fd);
+        return 1;
+    }
+
+    server->signal.type = SIGNAL_H;
+    server->signal.fd = int_signal;
+    server->sampler.type = SAMPLER_H;
+    server->coalescing = config->coalesce;
+    server->load_interval = config->load_interval;
+    server->window.type = WINDOW_H;
+    server->window.fd = -1;
+    server->window_phase = IDLE_W;
+    server->window_job.job.work = window_work;
+    server->window_job.job.complete = window_complete;
+    server->window_job.server = server;
+    admission_init(&server->admission, config->max_connections, config->max_waiting, config->max_delay);
+    server->linger_timeout = config->linger_timeout;
+    server->linger.type = LINGER_H;
+    server->linger.fd = -1;
+
+    // SIGINT isn't read from the file descriptor, so it wakes up all workers
+    if (watch_handler(server, &server->signal, EPOLLIN) != 0
+        || watch_handler(server, &server->sampler, EPOLLIN) != 0) {
+        close(server->sampler.fd);
+        close(server->epoll_fd);
+        return 1;
+    }
+
+    // Requests for CPU load are parked until the end of the measuring window of this event loop
+    if (server->coalescing
+        && ((server->window.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1
+            || watch_handler(server, &server->window, EPOLLIN) != 0)) {
+        fprintf(stderr, "Cannot create timer of measuring window\n");
+        if (server->window.fd != -1) {
+            close(server->window.fd);
+        }
+        close(server->sampler.fd);
+        close(server->epoll_fd);
+        return 1;
+    }
+
+    // Clients get some time for closing connections first (rejected ones always, others with -T)
+    if ((server->linger.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1
+        || watch_handler(server, &server->linger, EPOLLIN) != 0) {
+        fprintf(stderr, "Cannot create timer of lingering connections\n");
+        if (server->linger.fd != -1) {
+            close(server->linger.fd);
+        }
+        if (server->window.fd != -1) {
+            close(server->window.fd);
+        }
+        close(server->sampler.fd);
+        close(server->epoll_fd);
+        return 1;
+    }
+
+    // Blocking work is done by the offload pool, the event loop is notified about its results
+    if (offload_completions_init(&server->completions) != 0) {
+        if (server->linger.fd != -1) {
+            close(server->linger.fd);
+        }
+        if (server->window.fd != -1) {
+            close(server->window.fd);
+        }
+        close(server->sampler.fd);
+        close(server->epoll_fd);
+        return 1;
+    }
+    server->offload.type = OFFLOAD_H;
+    server->offload.fd = server->completions.fd;
+    if (watch_handler(server, &server->offload, EPOLLIN) != 0) {
+        offload_completions_free(&server->completions);
+        if (server->linger.fd != -1) {
+            close(server->linger.fd);
+        }
+        if (server->window.fd != -1) {
+            close(server->window.fd);
+        }
+        close(server->sampler.fd);
+        close(server->epoll_fd);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Adds a welcome socket served by the event loop
+ *
+ * Welcome sockets can be shared by more servers (workers), each connection is accepted by just one of them.
+ *
+ * @param server Server to add the socket to
+ * @param welcome_socket Listening welcome socket (TCP or UNIX one)
+ * @param stats Statistics of the listen endpoint (shared by all servers)
+ * @return 0 => success, 1 => error
+ */
+int server_add_listener(struct server *server, int welcome_socket, struct listener_stats *stats) {
+    struct listener *listener;
+
+    if (server->listeners_count >= MAX_LISTENERS) {
+        fprintf(stderr, "Too many welcome sockets (maximum is %d)\n", MAX_LISTENERS);
+        return 1;
+    }
+
+    listener = &server->listeners[server->listeners_count];
+    listener->handler.type = LISTENER_H;
+    listener->handler.fd = welcome_socket;
+    listener->stats = stats;
+
+    // Only one of the workers waiting for the socket is woken up by a new connection
+    if (watch_handler(server, &listener->handler, EPOLLIN | EPOLLEXCLUSIVE) != 0) {
+        return 1;
+    }
+
+    server->listeners_count++;
+    return 0;
+}
+
+/**
+ * Runs the event loop until SIGINT is received
+ *
+ * @param server Initialized server
+ * @return 0 => success, 1 => error
+ */
+int server_run(struct server *server) {
+    struct epoll_event events[MAX_EVENTS];
+    struct event_handler *handler;
+    int count;
+
+    while (server->keep_running) {
+        // Passive wait for new connection, data, sample or SIGINT
+        if ((count = epoll_wait(server->epoll_fd, events, MAX_EVENTS, -1)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, "Cannot wait for events\n");
+            return 1;
+        }
+
+        // Events of the iteration wait for the previous ones (the length of the iteration is their queueing delay)
+        admission_iteration_start(&server->admission);
+
+        for (int i = 0; i < count; i++) {
+            handler = events[i].data.ptr;
+
+            switch (handler->type) {
+                case LISTENER_H:
+                    accept_connections(server, (struct listener *) handler);
+                    break;
+                case SIGNAL_H:
+                    // Handling SIGINT --> stop the server
+                    server->keep_running = false;
+                    break;
+                case SAMPLER_H:
+                    handle_sample(server);
+                    break;
+                case WINDOW_H:
+                    handle_window(server);
+                    break;
+                case LINGER_H:
+                    handle_linger(server);
+                    break;
+                case OFFLOAD_H:
+                    handle_offload(server);
+                    break;
+                case CONNECTION_H:
+                    if (((struct connection *) handler)->state == CLOSED_C) {
+                        break;
+                    }
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        // Reset (or fully closed UNIX socket) aborts the request, nobody would read the response
+                        ((struct connection *) handler)->peer_closed = true;
+                        close_connection(server, (struct connection *) handler);
+                        break;
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                        read_connection(server, (struct connection *) handler);
+                    }
+                    if ((events[i].events & EPOLLOUT) && ((struct connection *) handler)->state != CLOSED_C) {
+                        flush_connection(server, (struct connection *) handler);
+                    }
+                    break;
+            }
+        }
+
+        release_closed_connections(server);
+        admission_iteration_end(&server->admission);
+    }
+
+    return 0;
+}
+
+/**
+ * Closes all connections and releases resources of the server
+ *
+ * @param server Server to destroy
+ */
+void server_destroy(struct server *server) {
+    while (server->connections != NULL) {
+        close_connection(server, server->connections);
+    }
+    release_closed_connections(server);
+
+    if (server->window.fd != -1) {
+        close(server->window.fd);
+    }
+    if (server->linger.fd != -1) {
+        close(server->linger.fd);
+    }
+    offload_completions_free(&server->completions);
+    close(server->sampler.fd);
+    close(server->epoll_fd);
+}
@@ -0,0 +1,246 @@
+#ifndef HINFOSVC_SERVER_H
+#define HINFOSVC_SERVER_H
+/**
+ * @file server.h
+ * Header of event loop serving HTTP connections
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include "http-processing.h"
+#include "string-buffer.h"
+#include "trace.h"
+#include "config.h"
+#include "rate-limit.h"
+#include "admission.h"
+#include "listener-stats.h"
+#include "system-info.h"
+#include "offload.h"
+
+/**
+ * Types of file descriptors watched by the event loop
+ */
+enum handler_type {
+    // Welcome (listening) socket
+    LISTENER_H,
+    // SIGINT file descriptor
+    SIGNAL_H,
+    // Event file descriptor notified by the sampler
+    SAMPLER_H,
+    // Timer of the measuring window (coalescing sampler)
+    WINDOW_H,
+    // Timer of lingering connections
+    LINGER_H,
+    // Event file descriptor notified by the offload pool
+    OFFLOAD_H,
+    // Connection socket
+    CONNECTION_H,
+};
+
+/**
+ * File descriptor watched by the event loop (epoll's user data point to it)
+ */
+struct event_handler {
+    enum handler_type type;
+    int fd;
+};
+
+/**
+ * Welcome socket
+ */
+struct listener {
+    // Watched socket (must be the first member)
+    struct event_handler handler;
+    // Statistics of the listen endpoint
+    struct listener_stats *stats;
+};
+
+/**
+ * Phases of the measuring window (coalescing sampler)
+ */
+enum window_phase {
+    // No measuring is planned
+    IDLE_W,
+    // Measuring will start after a delay (the next event of streams)
+    DELAYED_W,
+    // CPU statistics are being measured (the timer fires at the end of the window)
+    MEASURING_W,
+    // CPU statistics of the start of the window are being loaded by the offload pool
+    OPENING_W,
+    // CPU statistics of the end of the window are being loaded by the offload pool
+    CLOSING_W,
+};
+
+struct server;
+
+/**
+ * Loading of CPU statistics of the measuring window by the offload pool
+ */
+struct window_job {
+    // Job of the offload pool (it must be the first member)
+    struct offload_job job;
+    // Server measuring the window
+    struct server *server;
+    // Result of the loading (0 => success)
+    int result;
+    // Loaded CPU statistics
+    struct proc_stats stats;
+};
+
+/**
+ * States of the connection
+ */
+enum connection_state {
+    // Loading of the HTTP request
+    READING_C,
+    // Waiting for the first sample of CPU load
+    WAITING_SAMPLE_C,
+    // Waiting for the body collected by the offload pool
+    COLLECTING_C,
+    // Sending the response (the connection is closed after that)
+    WRITING_C,
+    // Sending events of CPU load stream (until the client closes the connection)
+    STREAMING_C,
+    // The response has been sent, the client should close the connection first (so the server avoids TIME_WAIT)
+    LINGERING_C,
+    // Closed connection waiting for releasing
+    CLOSED_C,
+};
+
+/**
+ * Connection with a client
+ */
+struct connection {
+    // Watched socket (must be the first member)
+    struct event_handler handler;
+    // Current state of the connection
+    enum connection_state state;
+    // Buffer the HTTP head is received to (see http_head_capacity())
+    char *input;
+    // Parser of the HTTP request (it works on the input buffer)
+    struct http_parser parser;
+    // Result of loading the HTTP request (see process_http_request())
+    int loading_result;
+    // Data waiting for sending
+    struct string_buffer output;
+    // Number of already sent bytes of the output
+    size_t output_sent;
+    // Is writability of the socket watched?
+    bool watch_write;
+    // Statistics of the endpoint the connection has been accepted by
+    struct listener_stats *stats;
+    // Trace record of the request
+    struct trace_record trace;
+    // Has been the trace record finished?
+    bool trace_finished;
+    // Sequential number of the last sample sent to the event stream
+    unsigned long long stream_sequence;
+    // Neighbours in the list of all connections
+    struct connection *prev, *next;
+    // Neighbours in the list of connections waiting for samples (waiting and streaming ones)
+    struct connection *prev_waiting, *next_waiting;
+    // Waiting for the body collected by the offload pool
+    struct collect_waiter collect_waiter;
+    // Has the client closed its side of the connection?
+    bool peer_closed;
+    // Has been the connection rejected by a prebuilt response? (it just lingers, it isn't admitted nor active)
+    bool rejected;
+    // Time when the lingering connection is closed by the server (monotonic time in milliseconds)
+    unsigned long long linger_deadline;
+    // Neighbours in the list of lingering connections (ordered by deadlines)
+    struct connection *prev_lingering, *next_lingering;
+};
+
+/**
+ * State of the event loop
+ */
+struct server {
+    // epoll instance
+    int epoll_fd;
+    // Welcome sockets (TCP and UNIX ones)
+    struct listener listeners[MAX_LISTENERS];
+    // Number of welcome sockets
+    unsigned listeners_count;
+    // SIGINT file descriptor
+    struct event_handler signal;
+    // Event file descriptor notified by the sampler
+    struct event_handler sampler;
+    // All open connections
+    struct connection *connections;
+    // Connections waiting for the next sample (waiting for the first one and event streams)
+    struct connection *waiting;
+    // Closed connections that will be released at the end of the current iteration
+    struct connection *closed;
+    // Per-client rate limiter shared by all workers (checked for each accepted connection)
+    struct rate_limiter *limiter;
+    // Admission control (checked for each accepted connection and each request waiting for CPU load)
+    struct admission admission;
+    // Does the event loop measure CPU load itself? (coalescing sampler)
+    bool coalescing;
+    // Sampling interval of CPU load (in seconds)
+    unsigned load_interval;
+    // Timer of the measuring window (coalescing sampler)
+    struct event_handler window;
+    // Current phase of the measuring window
+    enum window_phase window_phase;
+    // CPU statistics loaded at the start of the measuring window
+    struct proc_stats window_start;
+    // Loading of CPU statistics of the measuring window by the offload pool
+    struct window_job window_job;
+    // Jobs of the offload pool finished for this event loop
+    struct offload_completions completions;
+    // Event file descriptor of the completions
+    struct event_handler offload;
+    // How long the client has for closing the connection after the response (in milliseconds, 0 => no waiting)
+    unsigned linger_timeout;
+    // Timer of lingering connections (it fires at the deadline of the first one)
+    struct event_handler linger;
+    // Lingering connections (the first and the last one, new ones have the latest deadlines)
+    struct connection *lingering, *lingering_last;
+    // Number of lingering rejected connections
+    unsigned rejected_lingering;
+    // Should the event loop continue?
+    bool keep_running;
+};
+
+/**
+ * Inits the server (event loop)
+ *
+ * @param server Server to init
+ * @param config Configuration of the server
+ * @param int_signal SIGINT file descriptor
+ * @param limiter Per-client rate limiter (shared by all servers)
+ * @return 0 => success, 1 => error
+ */
+int server_init(struct server *server, const struct server_config *config, int int_signal,
+                struct rate_limiter *limiter);
+
+/**
+ * Adds a welcome socket served by the event loop
+ *
+ * Welcome sockets can be shared by more servers (workers), each connection is accepted by just one of them.
+ *
+ * @param server Server to add the socket to
+ * @param welcome_socket Listening welcome socket (TCP or UNIX one)
+ * @param stats Statistics of the listen endpoint (shared by all servers)
+ * @return 0 => success, 1 => error
+ */
+int server_add_listener(struct server *server, int welcome_socket, struct listener_stats *stats);
+
+/**
+ * Runs the event loop until SIGINT is received
+ *
+ * @param server Initialized server
+ * @return 0 => success, 1 => error
+ */
+int server_run(struct server *server);
+
+/**
+ * Closes all connections and releases resources of the server
+ *
+ * @param server Server to destroy
+ */
+void server_destroy(struct server *server);
+
+#endif //HINFOSVC_SERVER_H
@@ -0,0 +1,141 @@
+/**
+ * @file string-buffer.c
+ * Growable string buffer
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "string-buffer.h"
+
+/**
+ * Makes sure the buffer is able to hold the content of the given length
+ *
+ * @param buffer Buffer to work with
+ * @param length Required length of the content (without terminating '\0')
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_reserve(struct string_buffer *buffer, size_t length) {
+    size_t new_capacity = buffer->capacity;
+    char *new_data;
+
+    if (length + 1 <= buffer->capacity) {
+        return 0;
+    }
+
+    // Grow exponentially, so appending is amortized O(1)
+    while (new_capacity < length + 1) {
+        new_capacity *= 2;
+    }
+
+    if ((new_data = realloc(buffer->data, new_capacity)) == NULL) {
+        fprintf(stderr, "Cannot allocate memory for string buffer\n");
+        return 1;
+    }
+
+    buffer->data = new_data;
+    buffer->capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Inits the buffer and allocates its initial space
+ *
+ * @param buffer Buffer to init
+ * @param capacity Initial capacity (in bytes)
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_init(struct string_buffer *buffer, size_t capacity) {
+    if (capacity == 0) {
+        capacity = 1;
+    }
+
+    if ((buffer->data = malloc(capacity)) == NULL) {
+        fprintf(stderr, "Cannot allocate memory for string buffer\n");
+        return 1;
+    }
+
+    buffer->data[0] = '\0';
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Appends raw data to the end of the buffer
+ *
+ * @param buffer Buffer to append to
+ * @param data Data to append
+ * @param length Length of the data
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_append(struct string_buffer *buffer, const char *data, size_t length) {
+    if (string_buffer_reserve(buffer, buffer->length + length) != 0) {
+        return 1;
+    }
+
+    memcpy(&buffer->data[buffer->length], data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+    return 0;
+}
+
+/**
+ * Appends formatted text to the end of the buffer (printf-like)
+ *
+ * @param buffer Buffer to append to
+ * @param format Format string (see printf)
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_printf(struct string_buffer *buffer, const char *format, ...) {
+    va_list args;
+    int needed;
+
+    // Try to fit into already allocated space first
+    va_start(args, format);
+    needed = vsnprintf(&buffer->data[buffer->length], buffer->capacity - buffer->length, format, args);
+    va_end(args);
+
+    if (needed < 0) {
+        return 1;
+    }
+
+    if (buffer->length + needed + 1 > buffer->capacity) {
+        // Not enough space, text has been truncated --> grow and print it again
+        if (string_buffer_reserve(buffer, buffer->length + needed) != 0) {
+            buffer->data[buffer->length] = '\0';
+            return 1;
+        }
+
+        va_start(args, format);
+        vsnprintf(&buffer->data[buffer->length], buffer->capacity - buffer->length, format, args);
+        va_end(args);
+    }
+
+    buffer->length += needed;
+    return 0;
+}
+
+/**
+ * Removes content of the buffer (allocated space is kept for reuse)
+ *
+ * @param buffer Buffer to clear
+ */
+void string_buffer_clear(struct string_buffer *buffer) {
+    buffer->length = 0;
+    buffer->data[0] = '\0';
+}
+
+/**
+ * Frees allocated space of the buffer
+ *
+ * @param buffer Buffer to free
+ */
+void string_buffer_free(struct string_buffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef HINFOSVC_STRING_BUFFER_H
+#define HINFOSVC_STRING_BUFFER_H
+/**
+ * @file string-buffer.h
+ * Header of growable string buffer
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stddef.h>
+
+/**
+ * Growable buffer for building texts of unknown length (always '\0' terminated)
+ */
+struct string_buffer {
+    // Buffer content
+    char *data;
+    // Length of the content (without terminating '\0')
+    size_t length;
+    // Allocated size of data
+    size_t capacity;
+};
+
+/**
+ * Inits the buffer and allocates its initial space
+ *
+ * @param buffer Buffer to init
+ * @param capacity Initial capacity (in bytes)
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_init(struct string_buffer *buffer, size_t capacity);
+
+/**
+ * Appends raw data to the end of the buffer
+ *
+ * @param buffer Buffer to append to
+ * @param data Data to append
+ * @param length Length of the data
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_append(struct string_buffer *buffer, const char *data, size_t length);
+
+/**
+ * Appends formatted text to the end of the buffer (printf-like)
+ *
+ * @param buffer Buffer to append to
+ * @param format Format string (see printf)
+ * @return 0 => success, 1 => error
+ */
+int string_buffer_printf(struct string_buffer *buffer, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/**
+ * Removes content of the buffer (allocated space is kept for reuse)
+ *
+ * @param buffer Buffer to clear
+ */
+void string_buffer_clear(struct string_buffer *buffer);
+
+/**
+ * Frees allocated space of the buffer
+ *
+ * @param buffer Buffer to free
+ */
+void string_buffer_free(struct string_buffer *buffer);
+
+#endif //HINFOSVC_STRING_BUFFER_H
@@ -13,18 +13,34 @@
 #include "system-info.h"
 
 /**
- * Structure of records in /proc/stat
+ * Directory the system information is read from
  */
-struct proc_stats {
-    unsigned long user;
-    unsigned long nice;
-    unsigned long system;
-    unsigned long idle;
-    unsigned long iowait;
-    unsigned long irq;
-    unsigned long softirq;
-    unsigned long steal;
-};
+static const char *proc_root = DEFAULT_PROC_ROOT;
+
+/**
+ * Sets the directory the system information is read from (a synthetic fixture can be used instead of /proc)
+ *
+ * The hostname is read from sys/kernel/hostname of the directory if it isn't /proc.
+ *
+ * @param root Directory with files stat, cpuinfo and sys/kernel/hostname
+ */
+void set_proc_root(const char *root) {
+    proc_root = root;
+}
+
+/**
+ * Opens the file in the directory with system information
+ *
+ * @param name Path of the file relative to the directory
+ * @return Opened file or NULL on error
+ */
+FILE *open_proc_file(const char *name) {
+    char path[PROC_PATH_LEN + 1];
+
+    snprintf(path, sizeof(path), "%s/%s", proc_root, name);
+
+    return fopen(path, "r");
+}
 
 /**
  * Skips a line (or the rest of it) in the file
@@ -72,15 +88,16 @@ int load_proc_stats(struct proc_stats *stats) {
     // Data are loaded from /proc/stat, that looks like that (the header is implicit):
     //      user    nice   system  idle      iowait irq   softirq  steal  guest  guest_nice
     // cpu  74608   2520   24433   1117073   6176   4054  0        0      0      0
-    if ((proc_stats_file = fopen("/proc/stat", "r")) == NULL) {
-        fprintf(stderr, "Cannot open file /proc/stat\n");
+    if ((proc_stats_file = open_proc_file("stat")) == NULL) {
+        fprintf(stderr, "Cannot open file %s/stat\n", proc_root);
         return 1;
     }
 
     // Skip text start of the line ("cpu")
     fgets(buffer, sizeof(buffer), proc_stats_file);
     if (strcmp(buffer, "cpu") != 0) {
-        fprintf(stderr, "Bad line read from /proc/stat. The line doesn't start with: cpu\n");
+        fprintf(stderr, "Bad line read from %s/stat. The line doesn't start with: cpu\n", proc_root);
+        fclose(proc_stats_file);
         return 1;
     }
 
@@ -106,10 +123,16 @@ int load_proc_stats(struct proc_stats *stats) {
  */
 int get_hostname(char *hostname) {
     FILE *hostname_file;
+    bool fixture = strcmp(proc_root, DEFAULT_PROC_ROOT) != 0;
+
+    // The fixture has the name in the file, there is no command for it
+    if (fixture && (hostname_file = open_proc_file("sys/kernel/hostname")) == NULL) {
+        fprintf(stderr, "Cannot open file %s/sys/kernel/hostname\n", proc_root);
+        return 1;
+    }
 
     // Get output of `hostname` command
-    hostname_file = popen("/bin/hostname -f", "r");
-    if (hostname_file == NULL) {
+    if (!fixture && (hostname_file = popen("/bin/hostname -f", "r")) == NULL) {
         fprintf(stderr, "Cannot execute command `/bin/hostname -f`\n");
         return 1;
     }
@@ -120,7 +143,11 @@ int get_hostname(char *hostname) {
     // Remove '\n' from the end of the value
     hostname[strlen(hostname) - 1] = '\0';
 
-    pclose(hostname_file);
+    if (fixture) {
+        fclose(hostname_file);
+    } else {
+        pclose(hostname_file);
+    }
     return 0;
 }
 
@@ -138,7 +165,7 @@ int get_cpu_info(char *cpu_info) {
     int c;
 
     // CPU information is in the /proc/cpuinfo file --> open it
-    proc_cpu_info = fopen("/proc/cpuinfo", "r");
+    proc_cpu_info = open_proc_file("cpuinfo");
     if (proc_cpu_info == NULL) {
         return 1;
     }
@@ -180,16 +207,58 @@ int get_cpu_info(char *cpu_info) {
 }
 
 /**
- * Counts CPU load (for all CPU units)
+ * Loads the number of TCP sockets in TIME_WAIT state (of the whole system) from the /proc/net/sockstat virtual file
  *
- * @return positive number => CPU load value in %, -1 => error
- *
- * Inspired by: https://stackoverflow.com/a/23376195
+ * @param tcp_info Pointer to string where to save TCP statistics ("TIME_WAIT <count>")
+ * @return 0 => success, 1 => error
  */
-int get_cpu_load(void) {
-    struct proc_stats prev_st;
-    struct proc_stats curr_st;
+int get_tcp_info(char *tcp_info) {
+    char line[SOCKSTAT_LINE_LENGTH + 1];
+    char *name, *value, *position;
+    FILE *sockstat_file;
+
+    // The line with TCP sockets looks like (IPv6 sockets are included):
+    // TCP: inuse 4 orphan 0 tw 13784 alloc 9 mem 1
+    if ((sockstat_file = open_proc_file("net/sockstat")) == NULL) {
+        fprintf(stderr, "Cannot open file %s/net/sockstat\n", proc_root);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), sockstat_file) != NULL) {
+        if (strncmp(line, "TCP:", 4) != 0) {
+            // The rest of a too long line isn't taken as the next line
+            if (strchr(line, '\n') == NULL) {
+                skip_line(sockstat_file);
+            }
+            continue;
+        }
 
+        // Pairs of names and values follow
+        strtok_r(line, " \n", &position);
+        while ((name = strtok_r(NULL, " \n", &position)) != NULL
+               && (value = strtok_r(NULL, " \n", &position)) != NULL) {
+            if (strcmp(name, "tw") == 0) {
+                snprintf(tcp_info, TCP_INFO_LENGTH + 1, "TIME_WAIT %lu", strtoul(value, NULL, 10));
+                fclose(sockstat_file);
+                return 0;
+            }
+        }
+        break;
+    }
+
+    fprintf(stderr, "No TIME_WAIT count found in %s/net/sockstat\n", proc_root);
+    fclose(sockstat_file);
+    return 1;
+}
+
+/**
+ * Counts CPU load (for all CPU units) between two loadings of CPU statistics
+ *
+ * @param prev_st CPU statistics loaded at the beginning of measuring
+ * @param curr_st CPU statistics loaded at the end of measuring
+ * @return positive number => CPU load value in %, -1 => error (no time elapsed between loadings)
+ */
+int compute_cpu_load(const struct proc_stats *prev_st, const struct proc_stats *curr_st) {
     unsigned long long prev_idle;
     unsigned long long curr_idle;
     unsigned long long prev_active;
@@ -199,22 +268,11 @@ int get_cpu_load(void) {
     unsigned long long total_delta;
     unsigned long long idle_delta;
 
-    // First loading of the CPU stats
-    if (load_proc_stats(&prev_st) != 0) {
-        return -1;
-    }
-
-    // Second loading of the CPU stats
-    usleep(200 * 1000);
-    if (load_proc_stats(&curr_st) != 0) {
-        return -1;
-    }
+    prev_idle = prev_st->idle + prev_st->iowait;
+    curr_idle = curr_st->idle + curr_st->iowait;
 
-    prev_idle = prev_st.idle + prev_st.iowait;
-    curr_idle = curr_st.idle + curr_st.iowait;
-
-    prev_active = prev_st.user + prev_st.nice + prev_st.system + prev_st.irq + prev_st.softirq + prev_st.steal;
-    curr_active = curr_st.user + curr_st.nice + curr_st.system + curr_st.irq + curr_st.softirq + curr_st.steal;
+    prev_active = prev_st->user + prev_st->nice + prev_st->system + prev_st->irq + prev_st->softirq + prev_st->steal;
+    curr_active = curr_st->user + curr_st->nice + curr_st->system + curr_st->irq + curr_st->softirq + curr_st->steal;
 
     prev_total = prev_idle + prev_active;
     curr_total = curr_idle + curr_active;
@@ -222,6 +280,35 @@ int get_cpu_load(void) {
     total_delta = curr_total - prev_total;
     idle_delta = curr_idle - prev_idle;
 
+    if (total_delta == 0) {
+        return -1;
+    }
+
     // * 100 --> result is in %
     return (int) (((total_delta - idle_delta) * 100) / total_delta);
 }
+
+/**
+ * Counts CPU load (for all CPU units)
+ *
+ * @return positive number => CPU load value in %, -1 => error
+ *
+ * Inspired by: https://stackoverflow.com/a/23376195
+ */
+int get_cpu_load(void) {
+    struct proc_stats prev_st;
+    struct proc_stats curr_st;
+
+    // First loading of the CPU stats
+    if (load_proc_stats(&prev_st) != 0) {
+        return -1;
+    }
+
+    // Second loading of the CPU stats
+    usleep(CPU_LOAD_WINDOW * 1000);
+    if (load_proc_stats(&curr_st) != 0) {
+        return -1;
+    }
+
+    return compute_cpu_load(&prev_st, &curr_st);
+}
@@ -22,6 +22,51 @@
  * computer and school servers + some reserve
  */
 #define CPU_INFO_LENGTH 100
+/**
+ * Maximum length of TCP statistics string => strlen("TIME_WAIT 18446744073709551615")
+ */
+#define TCP_INFO_LENGTH 30
+/**
+ * Length of the line buffer used for reading the /proc/net/sockstat virtual file (its lines are much shorter)
+ */
+#define SOCKSTAT_LINE_LENGTH 255
+
+/**
+ * Length of the time window for measuring CPU load by get_cpu_load() (in milliseconds)
+ */
+#define CPU_LOAD_WINDOW 200
+
+/**
+ * Directory the system information is read from by default
+ */
+#define DEFAULT_PROC_ROOT "/proc"
+/**
+ * Maximum length of the path of a file with system information
+ */
+#define PROC_PATH_LEN 4095
+
+/**
+ * Structure of records in /proc/stat
+ */
+struct proc_stats {
+    unsigned long user;
+    unsigned long nice;
+    unsigned long system;
+    unsigned long idle;
+    unsigned long iowait;
+    unsigned long irq;
+    unsigned long softirq;
+    unsigned long steal;
+};
+
+/**
+ * Sets the directory the system information is read from (a synthetic fixture can be used instead of /proc)
+ *
+ * The hostname is read from sys/kernel/hostname of the directory if it isn't /proc.
+ *
+ * @param root Directory with files stat, cpuinfo and sys/kernel/hostname
+ */
+void set_proc_root(const char *root);
 
 /**
  * Finds and returns hostname of the computer keep_running this program
@@ -41,6 +86,31 @@ int get_hostname(char *hostname);
  */
 int get_cpu_info(char *cpu_info);
 
+/**
+ * Loads CPU statistics from the /proc/stat virtual file
+ *
+ * @param stats Pointer to the structure proc_stats where to store loaded information
+ * @return 0 => success, 1 => error
+ */
+int load_proc_stats(struct proc_stats *stats);
+
+/**
+ * Loads the number of TCP sockets in TIME_WAIT state (of the whole system) from the /proc/net/sockstat virtual file
+ *
+ * @param tcp_info Pointer to string where to save TCP statistics ("TIME_WAIT <count>")
+ * @return 0 => success, 1 => error
+ */
+int get_tcp_info(char *tcp_info);
+
+/**
+ * Counts CPU load (for all CPU units) between two loadings of CPU statistics
+ *
+ * @param prev_st CPU statistics loaded at the beginning of measuring
+ * @param curr_st CPU statistics loaded at the end of measuring
+ * @return positive number => CPU load value in %, -1 => error (no time elapsed between loadings)
+ */
+int compute_cpu_load(const struct proc_stats *prev_st, const struct proc_stats *curr_st);
+
 /**
  * Counts CPU load (for all CPU units)
  *
@@ -0,0 +1,216 @@
+/**
+ * @file trace.c
+ * Per-request phase tracing
+ *
+ * Finished requests are kept in a fixed-size ring and exported in Chrome trace format,
+ * so the output can be opened directly in chrome://tracing or https://ui.perfetto.dev
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include "trace.h"
+
+/**
+ * Is tracing on?
+ */
+static bool enabled = false;
+/**
+ * Sequential number of the last started request
+ */
+static unsigned long long last_id = 0;
+/**
+ * Ring of finished requests
+ */
+static struct trace_record ring[TRACE_CAPACITY];
+/**
+ * Index in the ring where the next record will be stored
+ */
+static unsigned ring_next = 0;
+/**
+ * Number of valid records in the ring
+ */
+static unsigned ring_count = 0;
+/**
+ * Lock of the ring (requests are finished by all workers)
+ */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns current time of the monotonic clock
+ *
+ * @return Current time in microseconds
+ */
+unsigned long long trace_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000000 + (unsigned long long) now.tv_nsec / 1000;
+}
+
+/**
+ * Turns tracing on (it is off by default)
+ */
+void trace_enable(void) {
+    enabled = true;
+}
+
+/**
+ * Checks if tracing is on
+ *
+ * @return Is tracing on?
+ */
+bool trace_is_enabled(void) {
+    return enabled;
+}
+
+/**
+ * Starts tracing of a new request (marks TRACE_ACCEPT phase)
+ *
+ * @param record Record of the request to init
+ */
+void trace_start(struct trace_record *record) {
+    memset(record, 0, sizeof(*record));
+
+    if (!enabled) {
+        return;
+    }
+
+    record->id = __atomic_add_fetch(&last_id, 1, __ATOMIC_RELAXED);
+    record->marks[TRACE_ACCEPT] = trace_now();
+}
+
+/**
+ * Marks reaching of the phase by the request
+ *
+ * @param record Record of the request
+ * @param phase Reached phase
+ */
+void trace_mark(struct trace_record *record, enum trace_phase phase) {
+    if (!enabled) {
+        return;
+    }
+
+    record->marks[phase] = trace_now();
+}
+
+/**
+ * Sets name of the data collector used by the request
+ *
+ * @param record Record of the request
+ * @param collector Name of the collector (must be a static string)
+ */
+void trace_set_collector(struct trace_record *record, const char *collector) {
+    record->collector = collector;
+}
+
+/**
+ * Finishes tracing of the request and stores its record to the trace ring
+ *
+ * @param record Record of the request
+ */
+void trace_finish(struct trace_record *record) {
+    if (!enabled) {
+        return;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    ring[ring_next] = *record;
+    ring_next = (ring_next + 1) % TRACE_CAPACITY;
+    if (ring_count < TRACE_CAPACITY) {
+        ring_count++;
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+/**
+ * Writes one complete ("X") event of Chrome trace format
+ *
+ * @param output Buffer where to write the event
+ * @param first Is it the first event in the array?
+ * @param name Name of the event
+ * @param record Request the event belongs to
+ * @param start Start of the event (in microseconds)
+ * @param end End of the event (in microseconds)
+ * @return 0 => success, 1 => error
+ */
+int trace_export_event(struct string_buffer *output, bool first, const char *name, const struct trace_record *record,
+                       unsigned long long start, unsigned long long end) {
+    return string_buffer_printf(output,
+                                "%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                                "\"pid\":1,\"tid\":%llu,\"args\":{\"request\":%llu}}",
+                                first ? "" : ",", name, start, end - start, record->id, record->id);
+}
+
+/**
+ * Exports requests finished in the last few seconds in Chrome trace format (JSON)
+ *
+ * @param output Buffer where to write the exported trace
+ * @param seconds Size of the time window (in seconds)
+ * @return 0 => success, 1 => error
+ */
+int trace_export(struct string_buffer *output, unsigned long seconds) {
+    unsigned long long now = trace_now();
+    unsigned long long window = (unsigned long long) seconds * 1000000;
+    unsigned long long after_parse;
+    const struct trace_record *record;
+    bool first = true;
+    unsigned index;
+    int result = 0;
+
+    result |= string_buffer_printf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    // Go from the oldest record to the newest one
+    pthread_mutex_lock(&ring_lock);
+    for (unsigned i = 0; i < ring_count; i++) {
+        index = (ring_next + TRACE_CAPACITY - ring_count + i) % TRACE_CAPACITY;
+        record = &ring[index];
+
+        if (now - record->marks[TRACE_WRITE_END] > window) {
+            continue;
+        }
+
+        // The whole request is the parent event, phases are nested in it
+        result |= trace_export_event(output, first, "request", record, record->marks[TRACE_ACCEPT],
+                                     record->marks[TRACE_WRITE_END]);
+        first = false;
+
+        // Requests that failed during loading don't reach all phases
+        if (record->marks[TRACE_FIRST_BYTE] != 0) {
+            result |= trace_export_event(output, first, "wait_first_byte", record, record->marks[TRACE_ACCEPT],
+                                         record->marks[TRACE_FIRST_BYTE]);
+        }
+        if (record->marks[TRACE_FIRST_BYTE] != 0 && record->marks[TRACE_HEADERS_END] != 0) {
+            result |= trace_export_event(output, first, "load_http_request", record,
+                                         record->marks[TRACE_FIRST_BYTE], record->marks[TRACE_HEADERS_END]);
+        }
+        if (record->marks[TRACE_HEADERS_END] != 0 && record->marks[TRACE_PARSE_END] != 0) {
+            result |= trace_export_event(output, first, "parse_http_request", record,
+                                         record->marks[TRACE_HEADERS_END], record->marks[TRACE_PARSE_END]);
+        }
+        if (record->collector != NULL) {
+            result |= trace_export_event(output, first, record->collector, record,
+                                         record->marks[TRACE_COLLECT_START], record->marks[TRACE_COLLECT_END]);
+        }
+
+        after_parse = record->collector != NULL ? record->marks[TRACE_COLLECT_END] : record->marks[TRACE_PARSE_END];
+        if (after_parse == 0) {
+            after_parse = record->marks[TRACE_HEADERS_END];
+        }
+        if (after_parse != 0 && record->marks[TRACE_BUILD_END] != 0) {
+            result |= trace_export_event(output, first, "build_response", record, after_parse,
+                                         record->marks[TRACE_BUILD_END]);
+        }
+        if (record->marks[TRACE_BUILD_END] != 0) {
+            result |= trace_export_event(output, first, "write_response", record, record->marks[TRACE_BUILD_END],
+                                         record->marks[TRACE_WRITE_END]);
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    result |= string_buffer_printf(output, "\n]}\n");
+
+    return result != 0;
+}
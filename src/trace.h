@@ -0,0 +1,108 @@
+#ifndef HINFOSVC_TRACE_H
+#define HINFOSVC_TRACE_H
+/**
+ * @file trace.h
+ * Header of per-request phase tracing
+ *
+ * @author Michal Šmahel (xsmahe01)
+ */
+#include <stdbool.h>
+#include "string-buffer.h"
+
+/**
+ * Number of finished requests kept in the trace ring
+ */
+#define TRACE_CAPACITY 4096
+/**
+ * Default time window for exporting the trace (in seconds)
+ */
+#define TRACE_DEFAULT_SECONDS 10
+
+/**
+ * Points in the request's life that are timestamped
+ */
+enum trace_phase {
+    // Connection has been accepted
+    TRACE_ACCEPT,
+    // The first byte of the request has been read
+    TRACE_FIRST_BYTE,
+    // The end of the HTTP head has been read (load_http_request() finished)
+    TRACE_HEADERS_END,
+    // parse_http_request() finished
+    TRACE_PARSE_END,
+    // Data collector (get_hostname(), get_cpu_info(), get_cpu_load()) started
+    TRACE_COLLECT_START,
+    // Data collector finished
+    TRACE_COLLECT_END,
+    // Response has been built
+    TRACE_BUILD_END,
+    // Response has been completely written to the socket
+    TRACE_WRITE_END,
+    // Number of phases (not a phase)
+    TRACE_PHASES_COUNT,
+};
+
+/**
+ * Timestamps of a single request
+ */
+struct trace_record {
+    // Sequential number of the request
+    unsigned long long id;
+    // Time of reaching each phase (in microseconds of monotonic clock, 0 => not reached)
+    unsigned long long marks[TRACE_PHASES_COUNT];
+    // Name of used data collector (NULL => no collector has been used)
+    const char *collector;
+};
+
+/**
+ * Turns tracing on (it is off by default)
+ */
+void trace_enable(void);
+
+/**
+ * Checks if tracing is on
+ *
+ * @return Is tracing on?
+ */
+bool trace_is_enabled(void);
+
+/**
+ * Starts tracing of a new request (marks TRACE_ACCEPT phase)
+ *
+ * @param record Record of the request to init
+ */
+void trace_start(struct trace_record *record);
+
+/**
+ * Marks reaching of the phase by the request
+ *
+ * @param record Record of the request
+ * @param phase Reached phase
+ */
+void trace_mark(struct trace_record *record, enum trace_phase phase);
+
+/**
+ * Sets name of the data collector used by the request
+ *
+ * @param record Record of the request
+ * @param collector Name of the collector (must be a static string)
+ */
+void trace_set_collector(struct trace_record *record, const char *collector);
+
+/**
+ * Finishes tracing of the request and stores its record to the trace ring
+ *
+ * @param record Record of the request
+ */
+void trace_finish(struct trace_record *record);
+
+/**
+ * Exports requests finished in the last few seconds in Chrome trace format (JSON)
+ *
+ * @param output Buffer where to write the exported trace
+ * @param seconds Size of the time window (in seconds)
+ * @return 0 => success, 1 => error
+ */
+int trace_export(struct string_buffer *output, unsigned long seconds);
+
+#endif //HINFOSVC_TRACE_H